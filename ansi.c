@@ -0,0 +1,474 @@
+/*
+ *      tty-pomodoro raw ANSI backend (--ansi).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Draws without terminfo or windows: the frame is a fixed cell
+ *      buffer (ansi_t.back) compared at each flush with what the terminal
+ *      shows (ansi_t.front). Only differing cells are sent, with the
+ *      shortest of an absolute or relative cursor move, and SGR or
+ *      charset sequences only when they change. A frame is one write().
+ *
+ *      Sequences assume an ANSI/VT100 terminal with default colours: SGR
+ *      39/49 and 3x/4x, DEC line drawing (ESC ( 0) for the box, CUP/CUU/
+ *      CUD/CUF/CUB for moves, the alternate screen and cursor hiding.
+ *
+ *      The SGR sequence between any two cell attributes is worked out
+ *      once per colour, by ansi_colors() from ansi_init() and
+ *      ansi_invalidate() (where ncurses has its init_pair()), and sent
+ *      from that table. The --progress bar is one more row of cells under
+ *      the frame, its partial cell a UTF-8 eighth block.
+ *
+ *      Byte budget per tick (bench/bench, idle):
+ *        one digit changing        <= 5 rows * (8 move + 6 * 6) = 220
+ *        blinking colon            <= 2 rows * (8 move + 2 * 6) =  40
+ *      so a tick changing two digits stays under 500 bytes. Any frame,
+ *      moves and full repaints included, goes out in ANSIBUF sized writes.
+ *
+ *      A frame shifted by one cell (ansi_shift(), the rebound animation)
+ *      is not resent: the terminal moves what it shows, with a scroll
+ *      region and LF/RI for a row (about 20 bytes) and ICH/DCH on each
+ *      row for a column (about 6 bytes a row), whatever the frame shows.
+ */
+
+#include "ttypomodoro.h"
+
+#define CELL_UNKNOWN 0xFF
+#define CELL(pair, blink, glyph) ((pair) | (blink) << 2 | (glyph) << 3)
+#define CELL_PAIR(c)  ((c) & 3)
+#define CELL_BLINK(c) ((c) & 4)
+#define CELL_GLYPH(c) ((c) >> 3)
+
+/* Glyphs: space, the DEC line drawing box pieces, then the left 1/8 to
+ * 7/8 blocks of the progress bar */
+enum { GLYPH_SPACE, GLYPH_UL, GLYPH_UR, GLYPH_LL, GLYPH_LR, GLYPH_H, GLYPH_V, GLYPH_BAR };
+static const char glyph_char[] = " lkmjqx";
+static const char bar_char[][4] =
+{
+     "\u258f", "\u258e", "\u258d", "\u258c", "\u258b", "\u258a", "\u2589"
+};
+
+/* Rows of cells: the frame, and the bar under it */
+static int rows(void){
+     return MIN(ttyclock->geo.h + (ttyclock->option.progress ? 1 : 0), ANSIROWS);
+}
+
+static void ansi_write(ansi_t *a){
+     size_t off = 0;
+     ssize_t n;
+
+     while(off < a->len)
+     {
+          if((n = write(a->fd, a->out + off, a->len - off)) < 0)
+          {
+               if(errno == EINTR)
+                    continue;
+               break;
+          }
+          off += n;
+     }
+     /* Through a pipe, term_flush() counts it */
+     if(ttyclock->cur->outfd < 0)
+          ttyclock->cur->stats.bytes += off;
+     a->len = 0;
+
+     return;
+}
+
+static void put(ansi_t *a, const char *s, size_t n){
+     if(a->len + n > sizeof(a->out))
+          ansi_write(a);
+     memcpy(a->out + a->len, s, n);
+     a->len += n;
+
+     return;
+}
+
+#define PUTS(a, s) put((a), (s), sizeof(s) - 1)
+
+/* Relative move along one axis: "" or ESC [ n <dir> */
+static int rel(char *buf, int n, char up, char down){
+     if(!n)
+          return 0;
+     if(n == 1 || n == -1)
+          return sprintf(buf, "\033[%c", n < 0 ? up : down);
+
+     return sprintf(buf, "\033[%d%c", n < 0 ? -n : n, n < 0 ? up : down);
+}
+
+/* Cursor to row r, column c with the shortest sequence */
+static void move_to(ansi_t *a, int r, int c){
+     char abs[32], rl[32];
+     int na, nr;
+
+     if(a->cy == r && a->cx == c)
+          return;
+
+     na = sprintf(abs, "\033[%d;%dH", r + 1, c + 1);
+     if(a->cy >= 0 && a->cx >= 0)
+     {
+          nr = rel(rl, r - a->cy, 'A', 'B');
+          if(c == 0 && a->cx)
+               rl[nr++] = '\r';
+          else
+               nr += rel(rl + nr, c - a->cx, 'D', 'C');
+          if(nr < na)
+          {
+               put(a, rl, nr);
+               a->cy = r;
+               a->cx = c;
+               return;
+          }
+     }
+     put(a, abs, na);
+     a->cy = r;
+     a->cx = c;
+
+     return;
+}
+
+/* SGR from attributes `from' (-1: unknown) to attr, into buf */
+static int sgr(char *buf, int from, int attr){
+     int n = 2, color = ttyclock->option.color;
+
+     if(from == attr)
+          return 0;
+
+     memcpy(buf, "\033[", 2);
+     if(from < 0 || (CELL_BLINK(from) && !CELL_BLINK(attr)))
+     {
+          n += sprintf(buf + n, "0;");
+          from = 0;
+     }
+     if(CELL_BLINK(attr) && !CELL_BLINK(from))
+          n += sprintf(buf + n, "5;");
+     if(CELL_PAIR(attr) != CELL_PAIR(from))
+     {
+          /* Undo the old pair's colour, then set the new one's */
+          if(CELL_PAIR(from) == 1 && CELL_PAIR(attr) != 1)
+               n += sprintf(buf + n, "49;");
+          if(CELL_PAIR(from) == 2 && CELL_PAIR(attr) != 2)
+               n += sprintf(buf + n, "39;");
+          if(CELL_PAIR(attr) == 1)
+               n += sprintf(buf + n, "4%d;", color);
+          if(CELL_PAIR(attr) == 2)
+               n += sprintf(buf + n, "3%d;", color);
+     }
+     /* Every part ends in ';', the last one ends the sequence */
+     buf[n - 1] = 'm';
+
+     return n;
+}
+
+/* The SGR between every two attributes, for the colour now in use */
+static void ansi_colors(ansi_t *a){
+     int from, to;
+
+     for(from = 0; from < ANSIATTRS + 1; ++from)
+          for(to = 0; to < ANSIATTRS; ++to)
+               a->sgrlen[from][to] = sgr(a->sgr[from][to], from < ANSIATTRS ? from : -1, to);
+
+     return;
+}
+
+/* SGR for a cell's pair and blink, elided when already in effect */
+static void set_attr(ansi_t *a, int attr){
+     int from = a->attr < 0 ? ANSIATTRS : a->attr;
+
+     put(a, a->sgr[from][attr], a->sgrlen[from][attr]);
+     a->attr = attr;
+
+     return;
+}
+
+void ansi_open(term_t *t){
+     ansi_t *a = &t->ansi;
+
+     a->fd = (t->outfd >= 0) ? fileno(t->out) : STDOUT_FILENO;
+     a->len = a->inlen = 0;
+     /* Alternate screen, no cursor */
+     PUTS(a, "\033[?1049h\033[?25l");
+
+     return;
+}
+
+/* (Re)start the current terminal from a blank screen */
+void ansi_init(void){
+     ansi_t *a = &ttyclock->cur->ansi;
+
+     PUTS(a, "\033[0m\033[H\033[2J");
+     memset(a->back, 0, sizeof(a->back));
+     memset(a->front, 0, sizeof(a->front));
+     a->x = a->ox = ttyclock->geo.x;
+     a->y = a->oy = ttyclock->geo.y;
+     a->oh = a->ow = 0;
+     a->cx = a->cy = 0;
+     a->attr = 0;
+     a->acs = -1;
+     ansi_colors(a);
+
+     return;
+}
+
+/* Set w frame cells from row x, column y to colour pair `pair'
+ * (draw_number(), draw_colon()) */
+void ansi_span(int x, int y, int w, int pair){
+     ansi_t *a = &ttyclock->cur->ansi;
+
+     if(x < 0 || x >= ANSIROWS || y < 0 || y >= ANSICOLS)
+          return;
+     memset(&a->back[x][y], CELL(pair, ttyclock->option.bold, GLYPH_SPACE), MIN(w, ANSICOLS - y));
+
+     return;
+}
+
+/* Fill cell c of the bar under the frame to eighths/8 (draw_progress()) */
+void ansi_bar(int c, int eighths){
+     ansi_t *a = &ttyclock->cur->ansi;
+     unsigned char *cell;
+
+     if(ttyclock->geo.h >= ANSIROWS || c < 0 || c + 1 >= ANSICOLS)
+          return;
+     cell = &a->back[ttyclock->geo.h][c + 1];
+     if(eighths <= 0)
+          *cell = CELL(0, 0, GLYPH_SPACE);
+     else if(eighths >= 8)
+          *cell = CELL(1, 0, GLYPH_SPACE);
+     else
+          *cell = CELL(2, 0, GLYPH_BAR + eighths - 1);
+
+     return;
+}
+
+/* Draw or erase the box around the frame (set_box()) */
+void ansi_box(Bool b){
+     ansi_t *a = &ttyclock->cur->ansi;
+     int h = ttyclock->geo.h, w = ttyclock->geo.w, bl = ttyclock->option.bold;
+     int i;
+
+     if(h < 2 || w < 2 || h > ANSIROWS || w > ANSICOLS)
+          return;
+
+     for(i = 1; i < w - 1; ++i)
+          a->back[0][i] = a->back[h - 1][i] = CELL(0, bl, b ? GLYPH_H : GLYPH_SPACE);
+     for(i = 1; i < h - 1; ++i)
+          a->back[i][0] = a->back[i][w - 1] = CELL(0, bl, b ? GLYPH_V : GLYPH_SPACE);
+     a->back[0][0] = CELL(0, bl, b ? GLYPH_UL : GLYPH_SPACE);
+     a->back[0][w - 1] = CELL(0, bl, b ? GLYPH_UR : GLYPH_SPACE);
+     a->back[h - 1][0] = CELL(0, bl, b ? GLYPH_LL : GLYPH_SPACE);
+     a->back[h - 1][w - 1] = CELL(0, bl, b ? GLYPH_LR : GLYPH_SPACE);
+
+     return;
+}
+
+/* Move the frame to row x, column y and clear it (clock_move()). What
+ * was left at the old place is erased by the next flush. */
+void ansi_move(int x, int y){
+     ansi_t *a = &ttyclock->cur->ansi;
+
+     memset(a->back, 0, sizeof(a->back));
+     a->x = x;
+     a->y = y;
+
+     return;
+}
+
+/* Move the frame by dx rows and dy columns, keeping what it shows
+ * (clock_shift()). The next flush has the terminal shift it. */
+void ansi_shift(int dx, int dy){
+     ansi_t *a = &ttyclock->cur->ansi;
+
+     a->x += dx;
+     a->y += dy;
+
+     return;
+}
+
+/* Forget what the terminal shows, e.g. after a colour change */
+void ansi_invalidate(void){
+     ansi_t *a = &ttyclock->cur->ansi;
+
+     memset(a->front, CELL_UNKNOWN, sizeof(a->front));
+     a->attr = -1;
+     ansi_colors(a);
+
+     return;
+}
+
+/* Have the terminal move the frame it shows by one cell towards where it
+ * is now, so that front matches the terminal at the new origin. Lines
+ * and columns outside of the frame must be blank: they scroll too. */
+static void shift(ansi_t *a, int lines, int cols){
+     char buf[32];
+     int dr = a->x - a->ox, dc = a->y - a->oy;
+     int r;
+
+     if(!dr && !dc)
+          return;
+     /* Further, resized or off screen: resent */
+     if(dr < -1 || dr > 1 || dc < -1 || dc > 1 || !a->oh
+        || a->oh != rows() || a->ow != MIN(ttyclock->geo.w, ANSICOLS)
+        || MIN(a->x, a->ox) < 0 || MAX(a->x, a->ox) + a->oh > lines
+        || MIN(a->y, a->oy) < 0 || MAX(a->y, a->oy) + a->ow > cols)
+          return;
+
+     /* Inserted and scrolled in cells take the current background */
+     set_attr(a, 0);
+     if(dr)
+     {
+          /* Scroll the rows from the top of both places to the bottom of
+           * both: up with LF at the bottom, down with RI at the top */
+          put(a, buf, sprintf(buf, "\033[%d;%dr", MIN(a->x, a->ox) + 1, MAX(a->x, a->ox) + a->oh));
+          /* Setting a region homes the cursor, as does resetting it */
+          a->cx = a->cy = 0;
+          move_to(a, dr < 0 ? MAX(a->x, a->ox) + a->oh - 1 : MIN(a->x, a->ox), 0);
+          if(dr < 0)
+               PUTS(a, "\n");
+          else
+               PUTS(a, "\033M");
+          PUTS(a, "\033[r");
+          a->cx = a->cy = 0;
+          a->ox = a->x;
+     }
+     if(dc)
+     {
+          /* On each row, insert a blank at the old left edge or delete the
+           * one left of the frame */
+          for(r = a->x; r < a->x + a->oh; ++r)
+          {
+               move_to(a, r, dc > 0 ? a->oy : a->y);
+               if(dc > 0)
+                    PUTS(a, "\033[@");
+               else
+                    PUTS(a, "\033[P");
+          }
+          a->oy = a->y;
+     }
+
+     return;
+}
+
+/* Send the cells that differ from the terminal, in one write() */
+void ansi_flush(void){
+     term_t *t = ttyclock->cur;
+     ansi_t *a = &t->ansi;
+     int r, c, want, have;
+     int h = rows(), w = MIN(ttyclock->geo.w, ANSICOLS);
+     int r0, r1, c0, c1;
+
+     shift(a, t->lines, t->cols);
+     r0 = MIN(a->x, a->ox);
+     r1 = MAX(a->x + h, a->ox + a->oh);
+     c0 = MIN(a->y, a->oy);
+     c1 = MAX(a->y + w, a->oy + a->ow);
+
+     /* Over the frame's old and new place, blank outside of either */
+     for(r = MAX(r0, 0); r < r1 && r < t->lines; ++r)
+          for(c = MAX(c0, 0); c < c1 && c < t->cols; ++c)
+          {
+               want = (r >= a->x && r < a->x + h && c >= a->y && c < a->y + w)
+                    ? a->back[r - a->x][c - a->y] : 0;
+               have = (r >= a->ox && r < a->ox + a->oh && c >= a->oy && c < a->oy + a->ow)
+                    ? a->front[r - a->ox][c - a->oy] : 0;
+               if(want == have)
+                    continue;
+
+               move_to(a, r, c);
+               set_attr(a, want & 7);
+               if(CELL_GLYPH(want) >= GLYPH_BAR)
+               {
+                    /* Out of line drawing for UTF-8 */
+                    if(a->acs)
+                    {
+                         PUTS(a, "\033(B");
+                         a->acs = 0;
+                    }
+                    put(a, bar_char[CELL_GLYPH(want) - GLYPH_BAR], 3);
+               }
+               else
+               {
+                    if(CELL_GLYPH(want) != GLYPH_SPACE && a->acs != 1)
+                    {
+                         PUTS(a, "\033(0");
+                         a->acs = 1;
+                    }
+                    put(a, &glyph_char[CELL_GLYPH(want)], 1);
+               }
+               /* The cursor stays put past the last column */
+               if(++a->cx >= t->cols)
+                    a->cx = -1;
+          }
+
+     memcpy(a->front, a->back, sizeof(a->front));
+     a->ox = a->x;
+     a->oy = a->y;
+     a->oh = h;
+     a->ow = w;
+     ansi_write(a);
+
+     return;
+}
+
+/* Next key of the current terminal as wgetch() would return it, or ERR */
+int ansi_getch(void){
+     term_t *t = ttyclock->cur;
+     ansi_t *a = &t->ansi;
+     struct pollfd p = { t->fd, POLLIN, 0 };
+     ssize_t n;
+     int c;
+
+     if(!a->inlen)
+     {
+          if(poll(&p, 1, 0) <= 0 || (n = read(t->fd, a->in, sizeof(a->in))) <= 0)
+               return ERR;
+          a->inlen = n;
+     }
+
+     /* Arrows, in normal (ESC [) or application (ESC O) cursor mode */
+     if(a->inlen >= 3 && a->in[0] == '\033' && (a->in[1] == '[' || a->in[1] == 'O')
+        && a->in[2] >= 'A' && a->in[2] <= 'D')
+     {
+          c = (int[]){ KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT }[a->in[2] - 'A'];
+          n = 3;
+     }
+     /* Focus in and out, window shown or iconified (see term_open()) */
+     else if(a->inlen >= 3 && !memcmp(a->in, "\033[", 2) && (a->in[2] == 'I' || a->in[2] == 'O'))
+     {
+          c = (a->in[2] == 'I') ? KEY_FOCUSIN : KEY_FOCUSOUT;
+          n = 3;
+     }
+     else if(a->inlen >= 4 && !memcmp(a->in, "\033[", 2) && (a->in[2] == '1' || a->in[2] == '2')
+             && a->in[3] == 't')
+     {
+          c = (a->in[2] == '1') ? KEY_SHOWN : KEY_ICONIFIED;
+          n = 4;
+     }
+     else
+     {
+          c = a->in[0];
+          n = 1;
+     }
+     a->inlen -= n;
+     memmove(a->in, a->in + n, a->inlen);
+
+     return c;
+}
+
+/* Ring the current terminal's bell now, not with the next frame */
+void ansi_bell(void){
+     ansi_t *a = &ttyclock->cur->ansi;
+
+     PUTS(a, "\a");
+     ansi_write(a);
+
+     return;
+}
+
+void ansi_close(term_t *t){
+     ansi_t *a = &t->ansi;
+
+     PUTS(a, "\033[0m\033(B\033[?25h\033[?1049l");
+     ansi_write(a);
+     a->fd = 0;
+
+     return;
+}
@@ -0,0 +1,327 @@
+/*
+ *      tty-pomodoro render benchmark.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Runs the real update_hour()/draw_terms() path, and with it
+ *      draw_clock(), draw_number() and clock_move(), against a pty for a
+ *      number of scenarios. The countdown is held paused and stepped by
+ *      one second per frame, so the timer runs on a virtual clock and the
+ *      frames go out back to back. The rebound scenarios run animation
+ *      frames (rebound_frame()) instead, the countdown left alone, and the
+ *      progress ones bar updates (progress_frame()), the countdown moved
+ *      on by one step of the bar each. The split one tiles 32 timers, of
+ *      which the first changes a frame. write(2) is interposed here to
+ *      count the calls and bytes reaching the tty; ncurses writes to the
+ *      fd under its FILE directly, so a stdio level count would miss them.
+ *
+ *      Then come the wakeups an hour of countdown costs under each tick
+ *      policy (tick_next()), played on the virtual clock, and last the
+ *      time status_read() of a --query segment takes, as a status bar
+ *      polling it would; the segment is a private copy, not the user's.
+ *
+ *      bench/bench [frames] prints a JSON array, one object per scenario.
+ */
+
+#include "../ttypomodoro.h"
+#include <pty.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define BENCH_FRAMES 1000
+
+typedef struct
+{
+     const char *name;
+     Bool second, blink, rebound, resize, ansi, progress;
+     /* Timers tiled with --split, 0 for none */
+     int split;
+} scenario_t;
+
+static const scenario_t scenario[] =
+{
+     { "idle",          False, False, False, False, False, False, 0  },
+     { "seconds",       True,  False, False, False, False, False, 0  },
+     { "blink",         False, True,  False, False, False, False, 0  },
+     { "rebound",       False, False, True,  False, False, False, 0  },
+     { "resize",        False, False, False, True,  False, False, 0  },
+     { "progress",      False, False, False, False, False, True,  0  },
+     { "split-32",      False, False, False, False, False, False, 32 },
+     { "ansi-idle",     False, False, False, False, True,  False, 0  },
+     { "ansi-seconds",  True,  False, False, False, True,  False, 0  },
+     { "ansi-blink",    False, True,  False, False, True,  False, 0  },
+     { "ansi-rebound",  False, False, True,  False, True,  False, 0  },
+     { "ansi-resize",   False, False, False, True,  True,  False, 0  },
+     { "ansi-progress", False, False, False, False, True,  True,  0  },
+};
+
+/* The pty, and the fd ncurses writes to */
+static int master, slave, tty = -1;
+static struct { unsigned long writes, bytes; } io;
+
+/* Throw away what the tty received */
+static void drain(void){
+     char buf[65536];
+
+     while(read(master, buf, sizeof(buf)) > 0);
+
+     return;
+}
+
+/* Every write(2) of the process comes through here */
+ssize_t write(int fd, const void *buf, size_t len){
+     ssize_t n;
+
+     for(;;)
+     {
+          n = syscall(SYS_write, fd, buf, len);
+          if(fd != tty || n >= 0 || errno != EAGAIN)
+               break;
+          /* The pty is full: play the terminal reading it */
+          drain();
+     }
+     if(fd == tty && n > 0)
+     {
+          ++io.writes;
+          io.bytes += n;
+     }
+
+     return n;
+}
+
+static void pty_size(int rows, int cols){
+     struct winsize ws = { rows, cols, 0, 0 };
+
+     ioctl(master, TIOCSWINSZ, &ws);
+
+     return;
+}
+
+static void run(const scenario_t *s, int frames, Bool first){
+     term_t *t = &ttyclock->term[0];
+     int lines = s->split ? 60 : 30, cols = s->split ? 240 : 100;
+     char spec[512];
+     size_t len = 0;
+     FILE *out, *in;
+     int64_t wall, cpu;
+     int i;
+
+     memset(ttyclock, 0, sizeof(*ttyclock));
+     ttyclock->option.format = "%F";
+     ttyclock->option.color = COLOR_RED;
+     ttyclock->option.delay = 1;
+     ttyclock->option.second = s->second;
+     ttyclock->option.blink = s->blink;
+     ttyclock->option.rebound = s->rebound;
+     ttyclock->option.ansi = s->ansi;
+     ttyclock->option.progress = s->progress;
+     ttyclock->option.eighths = True;
+     ttyclock->option.scale = 1;
+
+     /* 25 minutes on the virtual clock */
+     ttyclock->countdown.clock = CLOCK_MONOTONIC;
+     ttyclock->countdown.length = ttyclock->countdown.left = (int64_t)DEFAULT_TIME * 60 * NSEC_PER_SEC;
+     ttyclock->countdown.paused = True;
+
+     /* The other timers, all as long as the first */
+     for(i = 1; i < s->split; ++i)
+          len += snprintf(spec + len, sizeof(spec) - len, "%st%d=%d", i > 1 ? "," : "", i, DEFAULT_TIME);
+     if(s->split && split_parse(spec) < 0)
+     {
+          fprintf(stderr, "bench: error: bad --split spec '%s'.\n", spec);
+          exit(EXIT_FAILURE);
+     }
+
+     pty_size(lines, cols);
+     out = fdopen(dup(slave), "w");
+     in = fdopen(dup(slave), "r");
+     ttyclock->nterm = 1;
+     if(!out || !in || (!s->ansi && !(t->scr = newterm("xterm-256color", out, in))))
+     {
+          fprintf(stderr, "bench: error: couldn't set up the terminal.\n");
+          exit(EXIT_FAILURE);
+     }
+     t->fd = fileno(in);
+     t->outfd = -1;
+     t->lines = lines;
+     t->cols = cols;
+     tty = fileno(out);
+     if(s->ansi)
+     {
+          ansi_open(t);
+          t->ansi.fd = tty;
+     }
+     term_select(t);
+     init();
+     if(s->split)
+          split_open();
+     update_hour();
+     draw_terms();
+     fflush(out);
+     drain();
+
+     memset(&io, 0, sizeof(io));
+     wall = clock_ns(CLOCK_MONOTONIC);
+     cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+     for(i = 0; i < frames; ++i)
+     {
+          if(s->resize)
+          {
+               /* What resize_event() does after a SIGWINCH */
+               pty_size((t->lines = i % 2 ? 30 : 40), (t->cols = i % 2 ? 100 : 120));
+               if(!s->ansi)
+                    resizeterm(t->lines, t->cols);
+               apply_resize();
+          }
+          if(s->rebound)
+          {
+               /* What rebound_event() does at each animation frame */
+               rebound_frame();
+               fflush(out);
+               drain();
+               continue;
+          }
+          if(s->progress)
+          {
+               /* What progress_event() does at each step of the bar */
+               ttyclock->countdown.left -= ttyclock->countdown.length / ((ttyclock->geo.w - 2) * 8);
+               if(ttyclock->countdown.left <= 0)
+                    ttyclock->countdown.left = ttyclock->countdown.length;
+               progress_frame();
+               fflush(out);
+               drain();
+               continue;
+          }
+          ttyclock->countdown.left -= NSEC_PER_SEC;
+          update_hour();
+          draw_terms();
+          fflush(out);
+          drain();
+     }
+
+     cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+     wall = clock_ns(CLOCK_MONOTONIC) - wall;
+
+     printf("%s\n  {\"scenario\": \"%s\", \"frames\": %d, \"fps\": %.0f, "
+            "\"cpu_ns_per_frame\": %.0f, \"syscalls_per_frame\": %.2f, "
+            "\"bytes_per_frame\": %.1f, \"cells_per_frame\": %.1f}",
+            first ? "" : ",", s->name, frames, frames / (wall / 1e9),
+            (double)cpu / frames, (double)io.writes / frames,
+            (double)io.bytes / frames, (double)ttyclock->stats.cells / (frames + 1));
+
+     split_close();
+     if(s->ansi)
+          ansi_close(t);
+     else
+     {
+          endwin();
+          fflush(out);
+          delscreen(t->scr);
+     }
+     fclose(out);
+     fclose(in);
+     tty = -1;
+     drain();
+
+     return;
+}
+
+/* Count the ticks of an hour long countdown: seconds, a blinking colon,
+ * --minutes, both, and an iconified terminal */
+static void run_wakeups(void){
+     static const struct
+     {
+          const char *name;
+          Bool minutes, blink, hidden;
+     } policy[] =
+     {
+          { "wakeups-default",       False, False, False },
+          { "wakeups-blink",         False, True,  False },
+          { "wakeups-minutes",       True,  False, False },
+          { "wakeups-minutes-blink", True,  True,  False },
+          { "wakeups-hidden",        False, False, True  },
+     };
+     int64_t next, last;
+     unsigned long n;
+     size_t i;
+
+     for(i = 0; i < sizeof(policy) / sizeof(*policy); ++i)
+     {
+          memset(ttyclock, 0, sizeof(*ttyclock));
+          ttyclock->option.minutes = policy[i].minutes;
+          ttyclock->option.blink = policy[i].blink;
+          ttyclock->nterm = 1;
+          ttyclock->term[0].hidden = policy[i].hidden;
+          countdown_start(&ttyclock->countdown, CLOCK_VIRTUAL, 3600 * NSEC_PER_SEC);
+
+          /* Up to and with the end of the phase */
+          for(n = 0, last = 0; (next = tick_next()) != last; ++n)
+               clock_set_virtual((last = next));
+
+          printf(",\n  {\"scenario\": \"%s\", \"tick_seconds\": %g, \"wakeups_per_hour\": %lu}",
+                 policy[i].name, tick_unit() / 1e9, n);
+     }
+
+     return;
+}
+
+/* Read back a published state, the way a status bar polls it. The
+ * mapping is the bench's own: the user's segment, and a timer that may be
+ * publishing in it, are left alone. */
+static void run_status(int reads){
+     status_t *map, s;
+     int64_t cpu;
+     int i, torn = 0;
+
+     map = mmap(NULL, sizeof(status_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+     if(map == MAP_FAILED)
+          return;
+     memset(map, 0, sizeof(*map));
+     map->magic = STATUS_MAGIC;
+     map->seq = 2;
+     map->pid = getpid();
+     map->clock = CLOCK_MONOTONIC;
+     map->length = map->left = (int64_t)DEFAULT_TIME * 60 * NSEC_PER_SEC;
+     map->deadline = clock_ns(CLOCK_MONOTONIC) + map->left;
+
+     cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+     for(i = 0; i < reads; ++i)
+          torn += status_read(map, &s) < 0;
+     cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+     printf(",\n  {\"scenario\": \"status-read\", \"reads\": %d, \"cpu_ns_per_read\": %.1f, "
+            "\"failed\": %d}", reads, (double)cpu / reads, torn);
+
+     munmap(map, sizeof(status_t));
+
+     return;
+}
+
+int main(int argc, char **argv){
+     int frames = argc > 1 ? atoi(argv[1]) : BENCH_FRAMES;
+     size_t i;
+
+     /* The countdown is stepped a second per frame and must not run out */
+     if(frames < 1 || frames >= DEFAULT_TIME * 60)
+          frames = BENCH_FRAMES;
+
+     if(openpty(&master, &slave, NULL, NULL, NULL) < 0)
+     {
+          fprintf(stderr, "bench: error: couldn't open a pty: %s.\n", strerror(errno));
+          return EXIT_FAILURE;
+     }
+     fcntl(master, F_SETFL, O_NONBLOCK);
+     fcntl(slave, F_SETFL, O_NONBLOCK);
+
+     ttyclock = malloc(sizeof(ttyclock_t));
+     assert(ttyclock != NULL);
+
+     putchar('[');
+     for(i = 0; i < sizeof(scenario) / sizeof(*scenario); ++i)
+          run(&scenario[i], frames, !i);
+     run_wakeups();
+     run_status(frames * 1000);
+     printf("\n]\n");
+
+     return EXIT_SUCCESS;
+}
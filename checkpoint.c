@@ -0,0 +1,172 @@
+/*
+ *      tty-pomodoro checkpoint of the running timer.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      A small mmap'd file holding two slots. Each save fills the slot
+ *      not holding the latest state, with a higher sequence number and a
+ *      CRC-32 over the slot, so a save torn by a crash leaves the previous
+ *      one readable. The file only changes when the countdown does (start,
+ *      pause, resume), never on a tick, and --resume reads one slot back
+ *      instead of replaying the journal.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/mman.h>
+
+#define CHECKPOINT_SLOT 128
+
+enum { CHECKPOINT_NONE, CHECKPOINT_RUNNING, CHECKPOINT_PAUSED };
+
+typedef struct
+{
+     /* CRC-32 of the rest of the slot */
+     uint32_t crc;
+     uint32_t seq;
+     /* Boot the deadline belongs to (/proc/sys/kernel/random/boot_id) */
+     char boot[40];
+     int32_t clock;
+     uint16_t state;
+     uint16_t phase;
+     uint32_t cycle;
+     uint32_t pad;
+     /* Deadline on clock, time left and phase length, in ns */
+     int64_t deadline;
+     int64_t left;
+     int64_t length;
+     /* Wall clock of the save, ns since the epoch */
+     int64_t time;
+     char tag[8];
+} checkpoint_slot_t;
+
+static char *checkpoint_map = MAP_FAILED;
+
+static const char *boot_id(void){
+     static char id[40];
+     int fd;
+
+     if(!*id && (fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC)) >= 0)
+     {
+          if(read(fd, id, sizeof(id) - 1) < 0)
+               *id = '\0';
+          close(fd);
+     }
+
+     return id;
+}
+
+static Bool slot_valid(const checkpoint_slot_t *s){
+     return s->crc == crc32((const char *)s + sizeof(s->crc), sizeof(*s) - sizeof(s->crc));
+}
+
+/* The slot holding the latest state, NULL if neither is readable */
+static checkpoint_slot_t *slot_latest(void){
+     checkpoint_slot_t *a = (checkpoint_slot_t *)checkpoint_map;
+     checkpoint_slot_t *b = (checkpoint_slot_t *)(checkpoint_map + CHECKPOINT_SLOT);
+
+     if(!slot_valid(a))
+          return slot_valid(b) ? b : NULL;
+     if(!slot_valid(b))
+          return a;
+
+     return (int32_t)(b->seq - a->seq) > 0 ? b : a;
+}
+
+int checkpoint_open(void){
+     const char *path = data_path("checkpoint");
+     int fd;
+
+     if(!path || (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+          return -1;
+
+     if(ftruncate(fd, 2 * CHECKPOINT_SLOT) < 0)
+     {
+          close(fd);
+          return -1;
+     }
+     checkpoint_map = mmap(NULL, 2 * CHECKPOINT_SLOT, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+     close(fd);
+
+     return checkpoint_map == MAP_FAILED ? -1 : 0;
+}
+
+static void checkpoint_write(int state){
+     const countdown_t *cd = &ttyclock->countdown;
+     checkpoint_slot_t *last, *s;
+     int64_t left;
+
+     if(checkpoint_map == MAP_FAILED)
+          return;
+
+     last = slot_latest();
+     s = (checkpoint_slot_t *)(checkpoint_map
+                               + (last == (checkpoint_slot_t *)checkpoint_map ? CHECKPOINT_SLOT : 0));
+
+     left = countdown_left(cd);
+     memset(s, 0, sizeof(*s));
+     s->seq = last ? last->seq + 1 : 1;
+     strncpy(s->boot, boot_id(), sizeof(s->boot) - 1);
+     s->clock = cd->clock;
+     s->state = state;
+     s->phase = ttyclock->phase;
+     s->cycle = ttyclock->cycle;
+     s->deadline = cd->deadline;
+     s->left = left > 0 ? left : 0;
+     s->length = cd->length;
+     s->time = clock_ns(CLOCK_REALTIME);
+     if(ttyclock->option.tag)
+          strncpy(s->tag, ttyclock->option.tag, sizeof(s->tag));
+     s->crc = crc32((char *)s + sizeof(s->crc), sizeof(*s) - sizeof(s->crc));
+
+     /* Surviving the process is enough; the kernel writes it back */
+     msync(checkpoint_map, 2 * CHECKPOINT_SLOT, MS_ASYNC);
+
+     return;
+}
+
+/* Record the countdown as it is now */
+void checkpoint_save(void){
+     checkpoint_write(ttyclock->countdown.paused ? CHECKPOINT_PAUSED : CHECKPOINT_RUNNING);
+
+     return;
+}
+
+/* Nothing left to resume */
+void checkpoint_clear(void){
+     checkpoint_write(CHECKPOINT_NONE);
+
+     return;
+}
+
+/* Load the saved countdown, phase and cycle, -1 if there is none */
+int checkpoint_restore(void){
+     const checkpoint_slot_t *s;
+     countdown_t *cd = &ttyclock->countdown;
+     int64_t gone;
+
+     if(checkpoint_map == MAP_FAILED || !(s = slot_latest()) || s->state == CHECKPOINT_NONE)
+          return -1;
+
+     cd->clock = s->clock;
+     cd->length = s->length;
+     cd->paused = (s->state == CHECKPOINT_PAUSED);
+     cd->left = s->left;
+     if(!cd->paused)
+     {
+          if(!strcmp(s->boot, boot_id()))
+               cd->deadline = s->deadline;
+          else
+          {
+               /* The clock restarted with the system: go by the wall clock */
+               gone = clock_ns(CLOCK_REALTIME) - s->time;
+               cd->deadline = clock_ns(cd->clock) + s->left - (gone > 0 ? gone : 0);
+          }
+     }
+
+     ttyclock->phase = s->phase;
+     ttyclock->cycle = s->cycle;
+     ttyclock->option.suspend = (s->clock == CLOCK_MONOTONIC);
+     if(!ttyclock->option.tag && *s->tag)
+          ttyclock->option.tag = strndup(s->tag, sizeof(s->tag));
+
+     return 0;
+}
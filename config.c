@@ -0,0 +1,323 @@
+/*
+ *      tty-pomodoro configuration file.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      $XDG_CONFIG_HOME/tty-pomodoro/config (~/.config/tty-pomodoro/config,
+ *      or --config path) holds one setting a line, # starting a comment:
+ *
+ *        color = 2
+ *        box = yes
+ *        work = 50
+ *
+ *      It is read before the command line, which overrides it, in one pass
+ *      over a static buffer: nothing is allocated. An inotify watch on its
+ *      directory, which sees editors that write a new file and rename it
+ *      over the old, has it read again when it changes. A reload applies
+ *      only the settings whose value changed since the last read, so a
+ *      flag stays in force until the file sets that one setting anew, and
+ *      then does only what the matching key would: the countdown is left
+ *      alone, a new color repaints the digits, a new work length waits for
+ *      the next work phase. A file with a bad line is not applied at all.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/inotify.h>
+
+#define CONFIGMAX 4096
+
+/* What a changed setting needs done */
+enum
+{
+     CONFIG_DRAW = 1,    /* draw_terms(): colors, box, bold... */
+     CONFIG_TICK = 2,    /* arm_timer(): what a tick shows or how often */
+     CONFIG_REBOUND = 4, /* arm_rebound() */
+     CONFIG_PLAN = 8     /* The planned --cycle phases */
+};
+
+enum
+{
+     CONF_COLOR, CONF_BOLD, CONF_BOX, CONF_CENTER, CONF_REBOUND, CONF_BLINK, CONF_MINUTES,
+     CONF_DELAY, CONF_NSDELAY, CONF_FPS, CONF_WORK, CONF_SHORT, CONF_LONG, CONFIG_KEYS
+};
+
+static const struct
+{
+     const char *name;
+     /* Range; 0 to 1 takes yes/no, on/off and true/false too */
+     long min, max;
+     int effect;
+} key[CONFIG_KEYS] =
+{
+     [CONF_COLOR]   = { "color",   0, 7,          CONFIG_DRAW },
+     [CONF_BOLD]    = { "bold",    0, 1,          CONFIG_DRAW },
+     [CONF_BOX]     = { "box",     0, 1,          CONFIG_DRAW },
+     [CONF_CENTER]  = { "center",  0, 1,          CONFIG_DRAW | CONFIG_REBOUND },
+     [CONF_REBOUND] = { "rebound", 0, 1,          CONFIG_DRAW | CONFIG_REBOUND },
+     [CONF_BLINK]   = { "blink",   0, 1,          CONFIG_DRAW | CONFIG_TICK },
+     [CONF_MINUTES] = { "minutes", 0, 1,          CONFIG_DRAW | CONFIG_TICK },
+     [CONF_DELAY]   = { "delay",   0, 99,         CONFIG_TICK },
+     [CONF_NSDELAY] = { "nsdelay", 0, 999999999,  CONFIG_TICK },
+     [CONF_FPS]     = { "fps",     1, 1000,       CONFIG_REBOUND },
+     [CONF_WORK]    = { "work",    1, 24 * 60,    CONFIG_PLAN },
+     [CONF_SHORT]   = { "short",   1, 24 * 60,    CONFIG_PLAN },
+     [CONF_LONG]    = { "long",    1, 24 * 60,    CONFIG_PLAN },
+};
+
+/* The settings of one read of the file */
+typedef struct
+{
+     long value[CONFIG_KEYS];
+     /* Bit k: key k is set */
+     unsigned int set;
+} config_t;
+
+static config_t last;
+static char buf[CONFIGMAX];
+static int watchfd = -1;
+
+/* --config, or $XDG_CONFIG_HOME/tty-pomodoro/config or under ~/.config */
+const char *config_path(void){
+     static char path[PATH_MAX];
+     const char *conf = getenv("XDG_CONFIG_HOME");
+     const char *home = getenv("HOME");
+
+     if(ttyclock->option.config)
+          return ttyclock->option.config;
+     if(conf && *conf)
+          snprintf(path, sizeof(path), "%s/tty-pomodoro/config", conf);
+     else if(home && *home)
+          snprintf(path, sizeof(path), "%s/.config/tty-pomodoro/config", home);
+     else
+          return NULL;
+
+     return path;
+}
+
+static Bool word(const char *s, size_t n, const char *w){
+     return n == strlen(w) && !strncmp(s, w, n);
+}
+
+/* Value of key k in s, n long; -1 if it isn't one */
+static long value(int k, const char *s, size_t n){
+     long v;
+     char *end;
+
+     if(key[k].max == 1)
+     {
+          if(word(s, n, "yes") || word(s, n, "on") || word(s, n, "true"))
+               return 1;
+          if(word(s, n, "no") || word(s, n, "off") || word(s, n, "false"))
+               return 0;
+     }
+     v = strtol(s, &end, 10);
+     if(!n || end != s + n || v < key[k].min || v > key[k].max)
+          return -1;
+
+     return v;
+}
+
+/* Read the file into c; a missing file sets nothing. On a bad line, say
+ * where in err and return -1. */
+static int parse(config_t *c, char *err, size_t errlen){
+     const char *path = config_path();
+     char *s, *eol, *eq, *end;
+     ssize_t len = 0, n;
+     int fd, k, line = 0;
+     long v;
+
+     memset(c, 0, sizeof(*c));
+     if(!path || (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+          return 0;
+     while(len < CONFIGMAX - 1 && (n = read(fd, buf + len, CONFIGMAX - 1 - len)) > 0)
+          len += n;
+     close(fd);
+     buf[len] = '\0';
+
+     for(s = buf; *s; s = eol + !!*eol)
+     {
+          ++line;
+          if(!(eol = strchr(s, '\n')))
+               eol = s + strlen(s);
+          if((end = memchr(s, '#', eol - s)) == NULL)
+               end = eol;
+          /* Trim both ends */
+          for(; s < end && isspace((unsigned char)*s); ++s);
+          for(; end > s && isspace((unsigned char)end[-1]); --end);
+          if(s == end)
+               continue;
+
+          /* name = value */
+          v = -1;
+          if((eq = memchr(s, '=', end - s)))
+          {
+               for(n = eq - s; n && isspace((unsigned char)s[n - 1]); --n);
+               for(k = 0; k < CONFIG_KEYS && !word(s, n, key[k].name); ++k);
+               for(++eq; eq < end && isspace((unsigned char)*eq); ++eq);
+               if(k < CONFIG_KEYS)
+                    v = value(k, eq, end - eq);
+          }
+          if(v < 0)
+          {
+               snprintf(err, errlen, "%s:%d: bad setting", path, line);
+               return -1;
+          }
+          c->value[k] = v;
+          c->set |= 1u << k;
+     }
+
+     return 0;
+}
+
+/* Put setting k in the options; what it needs done */
+static int apply(int k, long v){
+     switch(k)
+     {
+     case CONF_COLOR:
+          ttyclock->option.color = v;
+          break;
+     case CONF_BOLD:
+          ttyclock->option.bold = v;
+          break;
+     case CONF_BOX:
+          ttyclock->option.box = v;
+          break;
+     case CONF_BLINK:
+          ttyclock->option.blink = v;
+          break;
+     case CONF_MINUTES:
+          ttyclock->option.minutes = v;
+          break;
+     case CONF_DELAY:
+          ttyclock->option.delay = v;
+          break;
+     case CONF_NSDELAY:
+          ttyclock->option.nsdelay = v;
+          break;
+     case CONF_FPS:
+          ttyclock->option.fps = v;
+          break;
+     case CONF_WORK:
+     case CONF_SHORT:
+     case CONF_LONG:
+          ttyclock->option.length[PHASE_WORK + k - CONF_WORK] = v * 60 * NSEC_PER_SEC;
+          break;
+     /* One or the other, as the keys have it */
+     case CONF_CENTER:
+          if((ttyclock->option.center = v))
+               ttyclock->option.rebound = False;
+          break;
+     case CONF_REBOUND:
+          if((ttyclock->option.rebound = v))
+               ttyclock->option.center = False;
+          break;
+     }
+
+     return key[k].effect;
+}
+
+/* At startup, before the command line */
+void config_load(void){
+     char err[PATH_MAX + 64];
+     int k;
+
+     if(parse(&last, err, sizeof(err)) < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: %s.\n", err);
+          exit(EXIT_FAILURE);
+     }
+     for(k = 0; k < CONFIG_KEYS; ++k)
+          if(last.set & (1u << k))
+               apply(k, last.value[k]);
+
+     return;
+}
+
+/* Read the file again, and apply what changed in it */
+static void reload(void){
+     char err[PATH_MAX + 64];
+     config_t c;
+     int k, effect = 0;
+
+     if(parse(&c, err, sizeof(err)) < 0)
+     {
+          ++ttyclock->stats.config_errors;
+          return;
+     }
+     ++ttyclock->stats.config_reloads;
+
+     for(k = 0; k < CONFIG_KEYS; ++k)
+          if((c.set & (1u << k)) && (!(last.set & (1u << k)) || c.value[k] != last.value[k]))
+               effect |= apply(k, c.value[k]);
+     last = c;
+
+     if(effect & CONFIG_PLAN)
+          schedule_plan();
+     if(effect & (CONFIG_TICK | CONFIG_PLAN))
+          arm_timer();
+     if(effect & CONFIG_REBOUND)
+          arm_rebound();
+     if(effect & CONFIG_TICK)
+          update_hour();
+     if(effect & (CONFIG_DRAW | CONFIG_TICK))
+          draw_terms();
+
+     return;
+}
+
+static void watch_event(int fd, short revents, void *arg){
+     char ev[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+     const struct inotify_event *e;
+     const char *name = arg;
+     Bool changed = False;
+     ssize_t n;
+     char *p;
+
+     while((n = read(fd, ev, sizeof(ev))) > 0)
+          for(p = ev; p < ev + n; p += sizeof(*e) + e->len)
+          {
+               e = (const struct inotify_event *)p;
+               changed |= (e->len && !strcmp(e->name, name));
+          }
+     if(changed)
+          reload();
+
+     return;
+}
+
+/* Watch the directory of the file, if there is one */
+void config_watch(void){
+     static char dir[PATH_MAX];
+     const char *path = config_path();
+     char *slash;
+
+     if(!path || strlen(path) >= sizeof(dir))
+          return;
+     strcpy(dir, path);
+     if((slash = strrchr(dir, '/')))
+          *slash = '\0';
+     else
+          strcpy(dir, ".");
+
+     if((watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+          return;
+     if(inotify_add_watch(watchfd, slash ? (*dir ? dir : "/") : dir,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) < 0)
+     {
+          close(watchfd);
+          watchfd = -1;
+          return;
+     }
+     loop_add(watchfd, POLLIN, watch_event, (void *)(slash ? slash + 1 : path));
+
+     return;
+}
+
+void config_close(void){
+     if(watchfd < 0)
+          return;
+     loop_del(watchfd);
+     close(watchfd);
+     watchfd = -1;
+
+     return;
+}
@@ -0,0 +1,104 @@
+/*
+ *      tty-pomodoro countdown engine.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      A countdown is an absolute deadline in nanoseconds on a monotonic
+ *      clock, so wall clock steps (NTP, date -s) never affect it.
+ *      CLOCK_BOOTTIME keeps running through a suspend, CLOCK_MONOTONIC
+ *      stops with the system; which one is used is the suspend policy.
+ *      CLOCK_VIRTUAL is no kernel clock: it stands still until moved by
+ *      clock_set_virtual(), for simulations and tests (see sim.c).
+ */
+
+#include "ttypomodoro.h"
+
+static int64_t virtual_now;
+
+/* Every time read goes through here */
+int64_t clock_ns(clockid_t clock){
+     struct timespec ts;
+
+     if(clock == CLOCK_VIRTUAL)
+          return virtual_now;
+     clock_gettime(clock, &ts);
+
+     return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Move the virtual clock to t; it never goes back */
+void clock_set_virtual(int64_t t){
+     if(t > virtual_now)
+          virtual_now = t;
+
+     return;
+}
+
+void countdown_start(countdown_t *cd, clockid_t clock, int64_t length){
+     cd->clock = clock;
+     cd->length = length;
+     cd->deadline = clock_ns(clock) + length;
+     cd->paused = False;
+
+     return;
+}
+
+/* While paused the remaining time is kept in cd->left instead */
+void countdown_pause(countdown_t *cd){
+     int64_t left = cd->deadline - clock_ns(cd->clock);
+
+     if(cd->paused)
+          return;
+     cd->left = left > 0 ? left : 0;
+     cd->paused = True;
+
+     return;
+}
+
+void countdown_resume(countdown_t *cd){
+     if(!cd->paused)
+          return;
+     cd->deadline = clock_ns(cd->clock) + cd->left;
+     cd->paused = False;
+
+     return;
+}
+
+/* Time left in nanoseconds, negative once the deadline has passed */
+int64_t countdown_left(const countdown_t *cd){
+     return cd->paused ? cd->left : cd->deadline - clock_ns(cd->clock);
+}
+
+void countdown_remaining(const countdown_t *cd, remaining_t *r){
+     int64_t left = countdown_left(cd);
+     unsigned int secs;
+
+     r->expired = (left <= 0);
+     r->ns = r->expired ? 0 : left;
+
+     /* Round up: a fresh 25 minute countdown reads 25:00, and 00:00 is
+      * only ever shown once the deadline has passed */
+     secs = (r->ns + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+     r->minutes = secs / 60;
+     r->seconds = secs % 60;
+
+     r->digit[0] = (r->minutes / 10) % 10;
+     r->digit[1] = r->minutes % 10;
+     r->digit[2] = r->seconds / 10;
+     r->digit[3] = r->seconds % 10;
+
+     return;
+}
+
+/* Absolute time (on cd->clock) at which the time left, rounded up to a
+ * unit (a second, a minute), next changes; the deadline if unit is 0, and
+ * 0 while paused */
+int64_t countdown_next_tick(const countdown_t *cd, int64_t unit){
+     int64_t left = cd->deadline - clock_ns(cd->clock);
+
+     if(cd->paused)
+          return 0;
+     if(left <= 0 || !unit)
+          return cd->deadline;
+
+     return cd->deadline - ((left - 1) / unit) * unit;
+}
@@ -0,0 +1,760 @@
+/*
+ *      tty-pomodoro timer daemon.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      --daemon runs any number of timers in one headless process.
+ *      Running timers sit in a min-heap ordered by deadline and a single
+ *      timerfd is armed for the earliest one, so a tick costs
+ *      O(expired * log n) however many timers exist. Clients talk to the
+ *      daemon over a Unix socket, one command per line:
+ *
+ *          create <seconds>            ok <id>, for up to a day
+ *          pause|resume|cancel <id>    ok <id>
+ *          query <id>                  timer <id> <state> <clock> <deadline> <left> <length>
+ *          watch <id>                  a timer line now and after every change
+ *
+ *      A client watches one timer at a time: watch moves it to the new one.
+ *
+ *      Deadlines are in nanoseconds on <clock> (boottime or monotonic),
+ *      left and length in nanoseconds. Failures are answered with
+ *      "err <reason>". Expired timers stay queryable until cancelled.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SLOTBITS  20
+#define MAXSLOTS  (1 << SLOTBITS)
+#define LINEMAX   128
+#define CLIENTBUF 4096
+
+typedef enum { TIMER_RUNNING, TIMER_PAUSED, TIMER_EXPIRED, TIMER_CANCELLED } timer_state_t;
+
+static const char *state_name[] = { "running", "paused", "expired", "cancelled" };
+
+typedef struct client client_t;
+
+typedef struct
+{
+     uint32_t gen;
+     Bool used;
+     timer_state_t state;
+     countdown_t cd;
+     /* Position in the heap, -1 unless running */
+     int hidx;
+     /* Clients watching this timer, linked through client_t.next */
+     client_t *watch;
+} dtimer_t;
+
+struct client
+{
+     int fd;
+     char in[LINEMAX];
+     size_t inlen;
+     char out[CLIENTBUF];
+     size_t outlen;
+     uint32_t watching;
+     client_t *next;
+};
+
+static dtimer_t *timer;
+static int *freeslot;
+static int ntimer, nfree, maxtimer;
+
+static int *heap;
+static int nheap;
+
+/* Closed clients, freed by client_reap() once no callback can use them */
+static client_t *zombie;
+
+static int daemon_timerfd;
+static clockid_t daemon_clock;
+
+const char *socket_path(void){
+     static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+     const char *dir = getenv("XDG_RUNTIME_DIR");
+
+     if(ttyclock->option.socket)
+          return ttyclock->option.socket;
+
+     if(dir && *dir)
+          snprintf(path, sizeof(path), "%s/tty-pomodoro.sock", dir);
+     else
+          snprintf(path, sizeof(path), "/tmp/tty-pomodoro-%u.sock", (unsigned)getuid());
+
+     return path;
+}
+
+static int socket_addr(struct sockaddr_un *sun, const char *path){
+     memset(sun, 0, sizeof(*sun));
+     sun->sun_family = AF_UNIX;
+     if(strlen(path) >= sizeof(sun->sun_path))
+     {
+          errno = ENAMETOOLONG;
+          return -1;
+     }
+     strcpy(sun->sun_path, path);
+
+     return 0;
+}
+
+int socket_connect(const char *path){
+     struct sockaddr_un sun;
+     int fd;
+
+     if(socket_addr(&sun, path) < 0)
+          return -1;
+     if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+          return -1;
+     if(connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+     {
+          close(fd);
+          return -1;
+     }
+
+     return fd;
+}
+
+/* Listen on path, taking over a stale socket but not a live one */
+int socket_listen(const char *path){
+     struct sockaddr_un sun;
+     mode_t mask;
+     int fd;
+
+     if((fd = socket_connect(path)) >= 0)
+     {
+          close(fd);
+          errno = EADDRINUSE;
+          return -1;
+     }
+     if(socket_addr(&sun, path) < 0)
+          return -1;
+     unlink(sun.sun_path);
+
+     if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+          return -1;
+
+     mask = umask(077);
+     if(bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(fd, 64) < 0)
+     {
+          umask(mask);
+          close(fd);
+          return -1;
+     }
+     umask(mask);
+
+     return fd;
+}
+
+/* Min-heap of running timers, by deadline */
+
+static Bool heap_less(int a, int b){
+     return timer[heap[a]].cd.deadline < timer[heap[b]].cd.deadline;
+}
+
+static void heap_swap(int a, int b){
+     int tmp = heap[a];
+
+     heap[a] = heap[b];
+     heap[b] = tmp;
+     timer[heap[a]].hidx = a;
+     timer[heap[b]].hidx = b;
+
+     return;
+}
+
+static void heap_up(int i){
+     while(i > 0 && heap_less(i, (i - 1) / 2))
+     {
+          heap_swap(i, (i - 1) / 2);
+          i = (i - 1) / 2;
+     }
+
+     return;
+}
+
+static void heap_down(int i){
+     int c;
+
+     while((c = 2 * i + 1) < nheap)
+     {
+          if(c + 1 < nheap && heap_less(c + 1, c))
+               ++c;
+          if(!heap_less(c, i))
+               break;
+          heap_swap(i, c);
+          i = c;
+     }
+
+     return;
+}
+
+static void heap_push(int slot){
+     heap[nheap] = slot;
+     timer[slot].hidx = nheap;
+     heap_up(nheap++);
+
+     return;
+}
+
+static void heap_remove(int slot){
+     int i = timer[slot].hidx;
+
+     if(i < 0)
+          return;
+
+     timer[slot].hidx = -1;
+     if(i != --nheap)
+     {
+          heap[i] = heap[nheap];
+          timer[heap[i]].hidx = i;
+          heap_down(i);
+          heap_up(i);
+     }
+
+     return;
+}
+
+/* Arm the timerfd for the earliest deadline, or disarm it */
+static void daemon_arm(void){
+     struct itimerspec its;
+     int64_t next;
+
+     memset(&its, 0, sizeof(its));
+     if(nheap)
+     {
+          next = timer[heap[0]].cd.deadline;
+          its.it_value.tv_sec = next / NSEC_PER_SEC;
+          its.it_value.tv_nsec = next % NSEC_PER_SEC;
+          /* A zero it_value would disarm the timer */
+          if(!its.it_value.tv_sec && !its.it_value.tv_nsec)
+               its.it_value.tv_nsec = 1;
+     }
+     timerfd_settime(daemon_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+     return;
+}
+
+static uint32_t timer_id(int slot){
+     return (timer[slot].gen << SLOTBITS) | slot;
+}
+
+static int timer_slot(uint32_t id){
+     int slot = id & (MAXSLOTS - 1);
+
+     if(slot >= ntimer || !timer[slot].used || timer_id(slot) != id)
+          return -1;
+
+     return slot;
+}
+
+static int timer_new(int64_t length){
+     int slot, n;
+     void *p;
+
+     if(nfree)
+          slot = freeslot[--nfree];
+     else
+     {
+          if(ntimer == MAXSLOTS)
+               return -1;
+          if(ntimer == maxtimer)
+          {
+               n = maxtimer ? maxtimer * 2 : 64;
+               if(!(p = realloc(timer, n * sizeof(*timer))))
+                    return -1;
+               timer = p;
+               if(!(p = realloc(heap, n * sizeof(*heap))))
+                    return -1;
+               heap = p;
+               if(!(p = realloc(freeslot, n * sizeof(*freeslot))))
+                    return -1;
+               freeslot = p;
+               maxtimer = n;
+          }
+          slot = ntimer++;
+          timer[slot].gen = 0;
+     }
+
+     /* Generation 0 is skipped so that no id is ever 0 */
+     timer[slot].gen = (timer[slot].gen + 1) & ((1u << (32 - SLOTBITS)) - 1);
+     if(!timer[slot].gen)
+          timer[slot].gen = 1;
+     timer[slot].used = True;
+     timer[slot].state = TIMER_RUNNING;
+     timer[slot].watch = NULL;
+     countdown_start(&timer[slot].cd, daemon_clock, length);
+     heap_push(slot);
+
+     return slot;
+}
+
+static int timer_line(int slot, char *buf, size_t size){
+     const countdown_t *cd = &timer[slot].cd;
+
+     return snprintf(buf, size, "timer %u %s %s %lld %lld %lld\n",
+                     timer_id(slot), state_name[timer[slot].state],
+                     cd->clock == CLOCK_MONOTONIC ? "monotonic" : "boottime",
+                     (long long)cd->deadline,
+                     (long long)(timer[slot].state == TIMER_EXPIRED ? 0 : countdown_left(cd)),
+                     (long long)cd->length);
+}
+
+/* Client connections */
+
+/* Take c off the watch list it is on */
+static void client_unwatch(client_t *c){
+     client_t **p;
+     int slot;
+
+     if(c->watching && (slot = timer_slot(c->watching)) >= 0)
+          for(p = &timer[slot].watch; *p; p = &(*p)->next)
+               if(*p == c)
+               {
+                    *p = c->next;
+                    break;
+               }
+     c->watching = 0;
+
+     return;
+}
+
+static void client_close(client_t *c){
+     if(c->fd < 0)
+          return;
+
+     client_unwatch(c);
+     loop_del(c->fd);
+     close(c->fd);
+     c->fd = -1;
+     c->next = zombie;
+     zombie = c;
+
+     return;
+}
+
+static void client_reap(void){
+     client_t *c;
+
+     while((c = zombie))
+     {
+          zombie = c->next;
+          free(c);
+     }
+
+     return;
+}
+
+static void client_write(client_t *c){
+     ssize_t n;
+
+     while(c->outlen)
+     {
+          if((n = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL)) < 0)
+          {
+               if(errno == EINTR)
+                    continue;
+               if(errno != EAGAIN)
+                    c->outlen = 0;
+               break;
+          }
+          memmove(c->out, c->out + n, c->outlen - n);
+          c->outlen -= n;
+     }
+     loop_set_events(c->fd, POLLIN | (c->outlen ? POLLOUT : 0));
+
+     return;
+}
+
+/* Queue a reply; a client too slow to keep CLIENTBUF free is dropped
+ * rather than allowed to hold the daemon up. Returns -1 if c is gone. */
+static int client_send(client_t *c, const char *buf, size_t len){
+     if(c->fd < 0)
+          return -1;
+     if(c->outlen + len > sizeof(c->out))
+     {
+          client_close(c);
+          return -1;
+     }
+     memcpy(c->out + c->outlen, buf, len);
+     c->outlen += len;
+     client_write(c);
+
+     return 0;
+}
+
+/* Tell every watcher about a change; the line is formatted only once */
+static void timer_notify(int slot){
+     char line[LINEMAX];
+     client_t *c, *next;
+     int len = timer_line(slot, line, sizeof(line));
+
+     for(c = timer[slot].watch; c; c = next)
+     {
+          next = c->next;
+          client_send(c, line, len);
+     }
+
+     return;
+}
+
+static void timer_free(int slot){
+     client_t *c;
+
+     heap_remove(slot);
+     timer[slot].state = TIMER_CANCELLED;
+     timer_notify(slot);
+
+     for(c = timer[slot].watch; c; c = c->next)
+          c->watching = 0;
+     timer[slot].watch = NULL;
+     timer[slot].used = False;
+     freeslot[nfree++] = slot;
+
+     return;
+}
+
+static int client_command(client_t *c, char *line){
+     static const char *known[] = { "create", "pause", "resume", "cancel", "query", "watch" };
+     char cmd[16], reply[LINEMAX];
+     unsigned long arg = 0;
+     int slot = -1, len, i;
+     int64_t before = nheap ? timer[heap[0]].cd.deadline : 0;
+
+     if(sscanf(line, "%15s %lu", cmd, &arg) < 1)
+          return 0;
+
+     for(i = 0; i < (int)(sizeof(known) / sizeof(*known)); ++i)
+          if(!strcmp(cmd, known[i]))
+               break;
+     if(i == (int)(sizeof(known) / sizeof(*known)))
+          return client_send(c, "err unknown command\n", 20);
+
+     if(!strcmp(cmd, "create"))
+     {
+          if(!arg || arg > 24 * 60 * 60 || (slot = timer_new((int64_t)arg * NSEC_PER_SEC)) < 0)
+               return client_send(c, "err can't create timer\n", 23);
+     }
+     else if((slot = timer_slot(arg)) < 0)
+          return client_send(c, "err no such timer\n", 18);
+     else if(!strcmp(cmd, "pause"))
+     {
+          if(timer[slot].state == TIMER_RUNNING)
+          {
+               heap_remove(slot);
+               countdown_pause(&timer[slot].cd);
+               timer[slot].state = TIMER_PAUSED;
+               timer_notify(slot);
+          }
+     }
+     else if(!strcmp(cmd, "resume"))
+     {
+          if(timer[slot].state == TIMER_PAUSED)
+          {
+               countdown_resume(&timer[slot].cd);
+               timer[slot].state = TIMER_RUNNING;
+               heap_push(slot);
+               timer_notify(slot);
+          }
+     }
+     else if(!strcmp(cmd, "cancel"))
+     {
+          len = snprintf(reply, sizeof(reply), "ok %u\n", timer_id(slot));
+          timer_free(slot);
+          daemon_arm();
+          return client_send(c, reply, len);
+     }
+     else
+     {
+          if(!strcmp(cmd, "watch") && c->watching != timer_id(slot))
+          {
+               client_unwatch(c);
+               c->watching = timer_id(slot);
+               c->next = timer[slot].watch;
+               timer[slot].watch = c;
+          }
+          len = timer_line(slot, reply, sizeof(reply));
+          return client_send(c, reply, len);
+     }
+
+     if(before != (nheap ? timer[heap[0]].cd.deadline : 0))
+          daemon_arm();
+
+     len = snprintf(reply, sizeof(reply), "ok %u\n", timer_id(slot));
+     return client_send(c, reply, len);
+}
+
+static void client_event(int fd, short revents, void *arg){
+     client_t *c = arg;
+     char *nl;
+     ssize_t n;
+
+     if(revents & POLLOUT)
+          client_write(c);
+
+     if(!(revents & (POLLIN | POLLHUP | POLLERR)))
+          return;
+
+     n = read(fd, c->in + c->inlen, sizeof(c->in) - c->inlen);
+     if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+     {
+          client_close(c);
+          return;
+     }
+     if(n < 0)
+          return;
+     c->inlen += n;
+
+     while((nl = memchr(c->in, '\n', c->inlen)))
+     {
+          *nl = '\0';
+          if(client_command(c, c->in) < 0)
+               return;
+          c->inlen -= nl + 1 - c->in;
+          memmove(c->in, nl + 1, c->inlen);
+     }
+
+     /* No command is that long */
+     if(c->inlen == sizeof(c->in))
+          client_close(c);
+
+     return;
+}
+
+static void accept_event(int fd, short revents, void *arg){
+     client_t *c;
+     int cfd;
+
+     while((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+     {
+          if(!(c = calloc(1, sizeof(*c))))
+          {
+               close(cfd);
+               continue;
+          }
+          c->fd = cfd;
+          loop_add(cfd, POLLIN, client_event, c);
+     }
+
+     return;
+}
+
+static void expire_event(int fd, short revents, void *arg){
+     uint64_t expirations;
+     int64_t now;
+     int slot;
+
+     if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          return;
+
+     now = clock_ns(daemon_clock);
+     while(nheap && timer[heap[0]].cd.deadline <= now)
+     {
+          slot = heap[0];
+          heap_remove(slot);
+          timer[slot].state = TIMER_EXPIRED;
+          timer_notify(slot);
+     }
+     daemon_arm();
+
+     return;
+}
+
+static void daemon_signal(int fd, short revents, void *arg){
+     struct signalfd_siginfo si;
+
+     while(read(fd, &si, sizeof(si)) == sizeof(si))
+          if(si.ssi_signo == SIGINT || si.ssi_signo == SIGTERM)
+               ttyclock->running = False;
+
+     return;
+}
+
+/* Serve timers until SIGINT/SIGTERM; runs in the foreground */
+int daemon_run(void){
+     sigset_t mask;
+     int lfd, sfd;
+
+     daemon_clock = ttyclock->option.suspend ? CLOCK_MONOTONIC : CLOCK_BOOTTIME;
+
+     sigemptyset(&mask);
+     sigaddset(&mask, SIGTERM);
+     sigaddset(&mask, SIGINT);
+     sigprocmask(SIG_BLOCK, &mask, NULL);
+
+     if((lfd = socket_listen(socket_path())) < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: can't listen on '%s': %s.\n",
+                  socket_path(), strerror(errno));
+          return EXIT_FAILURE;
+     }
+     sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+     daemon_timerfd = timerfd_create(daemon_clock, TFD_NONBLOCK | TFD_CLOEXEC);
+     if(sfd < 0 || daemon_timerfd < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: couldn't set up event sources: %s.\n",
+                  strerror(errno));
+          return EXIT_FAILURE;
+     }
+
+     loop_add(lfd, POLLIN, accept_event, NULL);
+     loop_add(sfd, POLLIN, daemon_signal, NULL);
+     loop_add(daemon_timerfd, POLLIN, expire_event, NULL);
+
+     ttyclock->running = True;
+     while(ttyclock->running)
+     {
+          loop_once(-1);
+          client_reap();
+     }
+
+     unlink(socket_path());
+
+     return EXIT_SUCCESS;
+}
+
+/*
+ * Thin client side: the ncurses UI attached to one daemon timer with
+ * --timer. The daemon owns the countdown; the UI mirrors it from the
+ * timer lines it is sent and forwards pause/resume.
+ */
+
+static int client_fd = -1;
+static uint32_t client_timer;
+static char client_buf[LINEMAX];
+static size_t client_len;
+
+/* Blocking read of one reply line, only used while attaching */
+static int client_readline(char *line, size_t size){
+     size_t n = 0;
+
+     while(n + 1 < size && read(client_fd, line + n, 1) == 1)
+          if(line[n++] == '\n')
+          {
+               line[n - 1] = '\0';
+               return 0;
+          }
+
+     return -1;
+}
+
+/* Mirror a "timer" line into ttyclock->countdown */
+static void client_apply(const char *line){
+     char state[16], clock[16];
+     long long deadline, left, length;
+     unsigned int id;
+     countdown_t *cd = &ttyclock->countdown;
+
+     if(sscanf(line, "timer %u %15s %15s %lld %lld %lld",
+               &id, state, clock, &deadline, &left, &length) != 6
+        || id != client_timer)
+          return;
+
+     if(!strcmp(state, "cancelled"))
+     {
+          ttyclock->running = False;
+          return;
+     }
+
+     cd->clock = strcmp(clock, "monotonic") ? CLOCK_BOOTTIME : CLOCK_MONOTONIC;
+     cd->deadline = deadline;
+     cd->length = length;
+     cd->left = left;
+     cd->paused = !strcmp(state, "paused");
+
+     return;
+}
+
+static void client_read_event(int fd, short revents, void *arg){
+     char *nl;
+     ssize_t n;
+
+     n = read(fd, client_buf + client_len, sizeof(client_buf) - client_len);
+     if(n <= 0)
+     {
+          if(n < 0 && (errno == EAGAIN || errno == EINTR))
+               return;
+          /* The daemon went away */
+          ttyclock->running = False;
+          return;
+     }
+     client_len += n;
+
+     while((nl = memchr(client_buf, '\n', client_len)))
+     {
+          *nl = '\0';
+          client_apply(client_buf);
+          client_len -= nl + 1 - client_buf;
+          memmove(client_buf, nl + 1, client_len);
+     }
+     if(client_len == sizeof(client_buf))
+          client_len = 0;
+
+     if(ttyclock->running)
+     {
+          arm_timer();
+          update_hour();
+          draw_terms();
+     }
+
+     return;
+}
+
+/* Attach to timer <id>, or to a new timer of length ns if id is "new".
+ * The countdown is mirrored before returning, so the first frame is right. */
+int client_attach(const char *id, int64_t length){
+     char line[LINEMAX];
+     int len;
+
+     if((client_fd = socket_connect(socket_path())) < 0)
+          return -1;
+
+     if(!strcmp(id, "new"))
+     {
+          len = snprintf(line, sizeof(line), "create %lld\n",
+                         (long long)(length / NSEC_PER_SEC));
+          if(write(client_fd, line, len) != len || client_readline(line, sizeof(line)) < 0
+             || sscanf(line, "ok %u", &client_timer) != 1)
+               goto fail;
+     }
+     else
+          client_timer = strtoul(id, NULL, 10);
+
+     len = snprintf(line, sizeof(line), "watch %u\n", client_timer);
+     if(write(client_fd, line, len) != len || client_readline(line, sizeof(line)) < 0
+        || strncmp(line, "timer ", 6))
+          goto fail;
+
+     ttyclock->running = True;
+     client_apply(line);
+     if(!ttyclock->running)
+          goto fail;
+
+     fcntl(client_fd, F_SETFL, O_NONBLOCK);
+     loop_add(client_fd, POLLIN, client_read_event, NULL);
+
+     return 0;
+
+fail:
+     errno = ENOENT;
+     close(client_fd);
+     client_fd = -1;
+     return -1;
+}
+
+Bool client_attached(void){
+     return client_fd >= 0;
+}
+
+void client_pause(Bool pause){
+     char line[LINEMAX];
+     int len = snprintf(line, sizeof(line), "%s %u\n",
+                        pause ? "pause" : "resume", client_timer);
+
+     /* The change comes back as a timer line; the "ok" is ignored */
+     if(send(client_fd, line, len, MSG_NOSIGNAL) != len)
+          ttyclock->running = False;
+
+     return;
+}
@@ -0,0 +1,126 @@
+/*
+ *      tty-pomodoro fonts (--font).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      A font is an atlas of FONTW x FONTH pixel glyphs, each a bitmask in
+ *      one 32 bit word found at its ASCII code: pixel (r, c) is bit
+ *      FONTW * FONTH - 1 - (r * FONTW + c), the top left one the highest.
+ *      It holds the digits, the colon and the capitals of the phase names.
+ *      The built-in font is such a table, packed by the compiler from the
+ *      rows below; --font maps a file that is the same table byte for byte:
+ *
+ *        "TPF1", width, height, two zero bytes, 128 little endian glyphs
+ *
+ *      so a glyph is one load, the digits and the colon sharing one cache
+ *      line, and switching fonts ('f') is choosing another table. A glyph
+ *      is drawn as spans worked out from its bits: one per run of lit or
+ *      unlit pixels on a pixel row, repeated and widened by the scale.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/mman.h>
+
+/* Five rows of three pixels, written as binary */
+#define GLYPH(a, b, c, d, e) ((a) << 12 | (b) << 9 | (c) << 6 | (d) << 3 | (e))
+
+static const font_t builtin __attribute__((aligned(64))) =
+{
+     FONT_MAGIC, FONTW, FONTH, 0,
+     {
+          ['0'] = GLYPH(0b111, 0b101, 0b101, 0b101, 0b111),
+          ['1'] = GLYPH(0b001, 0b001, 0b001, 0b001, 0b001),
+          ['2'] = GLYPH(0b111, 0b001, 0b111, 0b100, 0b111),
+          ['3'] = GLYPH(0b111, 0b001, 0b111, 0b001, 0b111),
+          ['4'] = GLYPH(0b101, 0b101, 0b111, 0b001, 0b001),
+          ['5'] = GLYPH(0b111, 0b100, 0b111, 0b001, 0b111),
+          ['6'] = GLYPH(0b111, 0b100, 0b111, 0b101, 0b111),
+          ['7'] = GLYPH(0b111, 0b001, 0b001, 0b001, 0b001),
+          ['8'] = GLYPH(0b111, 0b101, 0b111, 0b101, 0b111),
+          ['9'] = GLYPH(0b111, 0b101, 0b111, 0b001, 0b111),
+          [':'] = GLYPH(0b000, 0b010, 0b000, 0b010, 0b000),
+          ['A'] = GLYPH(0b010, 0b101, 0b111, 0b101, 0b101),
+          ['B'] = GLYPH(0b110, 0b101, 0b110, 0b101, 0b110),
+          ['E'] = GLYPH(0b111, 0b100, 0b110, 0b100, 0b111),
+          ['G'] = GLYPH(0b011, 0b100, 0b101, 0b101, 0b011),
+          ['H'] = GLYPH(0b101, 0b101, 0b111, 0b101, 0b101),
+          ['K'] = GLYPH(0b101, 0b101, 0b110, 0b101, 0b101),
+          ['L'] = GLYPH(0b100, 0b100, 0b100, 0b100, 0b111),
+          ['N'] = GLYPH(0b110, 0b101, 0b101, 0b101, 0b101),
+          ['O'] = GLYPH(0b111, 0b101, 0b101, 0b101, 0b111),
+          ['R'] = GLYPH(0b110, 0b101, 0b110, 0b101, 0b101),
+          ['S'] = GLYPH(0b011, 0b100, 0b010, 0b001, 0b110),
+          ['T'] = GLYPH(0b111, 0b010, 0b010, 0b010, 0b010),
+          ['W'] = GLYPH(0b101, 0b101, 0b101, 0b111, 0b101),
+     }
+};
+
+/* The built-in font, and the one given with --font if any */
+static const font_t *font[2] = { &builtin, NULL };
+
+/* Map the atlas at path as the second font */
+int font_load(const char *path){
+     const font_t *f;
+     struct stat st;
+     int fd;
+
+     if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+          return -1;
+     if(fstat(fd, &st) < 0 || st.st_size != sizeof(font_t))
+     {
+          close(fd);
+          errno = EINVAL;
+          return -1;
+     }
+     f = mmap(NULL, sizeof(font_t), PROT_READ, MAP_PRIVATE, fd, 0);
+     close(fd);
+     if(f == MAP_FAILED)
+          return -1;
+
+     /* The frame is laid out for the built-in glyph size */
+     if(memcmp(f->magic, FONT_MAGIC, 4) || f->width != FONTW || f->height != FONTH)
+     {
+          munmap((void *)f, sizeof(font_t));
+          errno = EINVAL;
+          return -1;
+     }
+     font[1] = f;
+
+     return 0;
+}
+
+/* Whether there is a font to switch to */
+Bool font_loaded(void){
+     return font[1] != NULL;
+}
+
+/* The built-in atlas, as --font takes it */
+int font_dump(void){
+     return fwrite(&builtin, sizeof(builtin), 1, stdout) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Spans of glyph c at scale, relative to its top left corner, lit pixels
+ * in colour pair `pair'; sp has room for FONTSPANS */
+int font_spans(int c, int scale, int pair, span_t *sp){
+     uint32_t bits = font[ttyclock->option.font && font[1]]->glyph[c & (FONTGLYPHS - 1)];
+     unsigned int row, lit;
+     int r, col, end, k, n = 0;
+
+     for(r = 0; r < FONTH; ++r)
+     {
+          row = bits >> ((FONTH - 1 - r) * FONTW);
+          for(col = 0; col < FONTW; col = end)
+          {
+               lit = row >> (FONTW - 1 - col) & 1;
+               for(end = col + 1; end < FONTW && (row >> (FONTW - 1 - end) & 1) == lit; ++end);
+               for(k = 0; k < scale; ++k, ++n)
+               {
+                    sp[n].x = r * scale + k;
+                    sp[n].y = col * 2 * scale;
+                    sp[n].w = (end - col) * 2 * scale;
+                    sp[n].pair = lit ? pair : 0;
+               }
+          }
+     }
+
+     return n;
+}
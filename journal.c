@@ -0,0 +1,253 @@
+/*
+ *      tty-pomodoro session journal.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      An append-only file of fixed 32 byte records after a 32 byte
+ *      header. Each record carries a CRC-32 of its other 28 bytes, so a
+ *      reader can tell a torn or damaged record from a good one. Records
+ *      are written with a single O_APPEND write(); fdatasync() is
+ *      batched: a session's end is synced at once, anything else within
+ *      JOURNAL_SYNC_NS, so a crash loses at most the last few records.
+ *
+ *      Readers mmap the file and walk journal_rec_t pointers: nothing is
+ *      parsed or allocated, and since records are appended in time order
+ *      journal_seek() finds the start of a date range by bisection.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/mman.h>
+
+#define JOURNAL_MAGIC   "TTYPJRN1"
+#define JOURNAL_SYNC_NS (5 * NSEC_PER_SEC)
+
+typedef struct
+{
+     char magic[8];
+     uint32_t version;
+     uint32_t recsize;
+     char pad[16];
+} journal_hdr_t;
+
+static int journal_fd = -1;
+static Bool journal_dirty;
+static int64_t journal_synced;
+
+uint32_t crc32(const void *buf, size_t len){
+     static uint32_t table[256];
+     const unsigned char *p = buf;
+     uint32_t c, crc = 0xFFFFFFFF;
+     int i, j;
+
+     if(!table[1])
+          for(i = 0; i < 256; ++i)
+          {
+               for(c = i, j = 0; j < 8; ++j)
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+               table[i] = c;
+          }
+
+     while(len--)
+          crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+     return crc ^ 0xFFFFFFFF;
+}
+
+/* $XDG_DATA_HOME/tty-pomodoro/<name>, or under ~/.local/share */
+const char *data_path(const char *name){
+     static char path[PATH_MAX];
+     const char *data = getenv("XDG_DATA_HOME");
+     const char *home = getenv("HOME");
+     char *slash;
+
+     if(data && *data)
+          snprintf(path, sizeof(path), "%s/tty-pomodoro/%s", data, name);
+     else if(home && *home)
+          snprintf(path, sizeof(path), "%s/.local/share/tty-pomodoro/%s", home, name);
+     else
+          return NULL;
+
+     /* mkdir -p of the directory part */
+     for(slash = path + 1; (slash = strchr(slash, '/')); ++slash)
+     {
+          *slash = '\0';
+          mkdir(path, 0700);
+          *slash = '/';
+     }
+
+     return path;
+}
+
+const char *journal_path(void){
+     if(ttyclock->option.journal)
+          return ttyclock->option.journal;
+
+     return data_path("journal");
+}
+
+int journal_open(void){
+     journal_hdr_t hdr;
+     const char *path = journal_path();
+     struct stat st;
+
+     if(!path || (journal_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0)
+          return -1;
+
+     if(fstat(journal_fd, &st) < 0)
+          goto fail;
+
+     if(st.st_size == 0)
+     {
+          memset(&hdr, 0, sizeof(hdr));
+          memcpy(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+          hdr.version = 1;
+          hdr.recsize = sizeof(journal_rec_t);
+          if(write(journal_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+               goto fail;
+     }
+     else if(pread(journal_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+             || memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic))
+             || hdr.recsize != sizeof(journal_rec_t))
+     {
+          errno = EINVAL;
+          goto fail;
+     }
+     /* Cut a record torn by a crash so that the next ones stay aligned */
+     else if((st.st_size - sizeof(hdr)) % sizeof(journal_rec_t))
+          if(ftruncate(journal_fd, st.st_size - (st.st_size - sizeof(hdr)) % sizeof(journal_rec_t)) < 0)
+               goto fail;
+
+     journal_synced = clock_ns(CLOCK_MONOTONIC);
+
+     return 0;
+
+fail:
+     close(journal_fd);
+     journal_fd = -1;
+     return -1;
+}
+
+void journal_sync(void){
+     if(journal_fd < 0 || !journal_dirty)
+          return;
+
+     fdatasync(journal_fd);
+     journal_dirty = False;
+     journal_synced = clock_ns(CLOCK_MONOTONIC);
+
+     return;
+}
+
+/* Record an event of the running countdown */
+void journal_append(int type){
+     journal_rec_t r;
+     const countdown_t *cd = &ttyclock->countdown;
+     int64_t left;
+
+     if(journal_fd < 0)
+          return;
+
+     left = countdown_left(cd);
+     if(left < 0)
+          left = 0;
+
+     memset(&r, 0, sizeof(r));
+     r.type = type;
+     r.phase = ttyclock->phase;
+     r.time = clock_ns(CLOCK_REALTIME);
+     r.length = cd->length / NSEC_PER_SEC;
+     r.elapsed = (cd->length - left) / NSEC_PER_SEC;
+     if(ttyclock->option.tag)
+          strncpy(r.tag, ttyclock->option.tag, sizeof(r.tag));
+     r.crc = crc32((char *)&r + sizeof(r.crc), sizeof(r) - sizeof(r.crc));
+
+     if(write(journal_fd, &r, sizeof(r)) != sizeof(r))
+          return;
+     journal_dirty = True;
+
+     if(type == JOURNAL_COMPLETE || type == JOURNAL_INTERRUPT
+        || clock_ns(CLOCK_MONOTONIC) - journal_synced >= JOURNAL_SYNC_NS)
+          journal_sync();
+
+     return;
+}
+
+void journal_close(void){
+     if(journal_fd < 0)
+          return;
+
+     journal_sync();
+     close(journal_fd);
+     journal_fd = -1;
+
+     return;
+}
+
+/* Reader side */
+
+int journal_map(const char *path, journal_map_t *m){
+     const journal_hdr_t *hdr;
+     struct stat st;
+     int fd;
+
+     memset(m, 0, sizeof(*m));
+     if(!path || (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+          return -1;
+
+     if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(journal_hdr_t))
+     {
+          close(fd);
+          errno = EINVAL;
+          return -1;
+     }
+
+     m->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+     close(fd);
+     if(m->map == MAP_FAILED)
+     {
+          m->map = NULL;
+          return -1;
+     }
+     m->size = st.st_size;
+
+     hdr = m->map;
+     if(memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic))
+        || hdr->recsize != sizeof(journal_rec_t))
+     {
+          journal_unmap(m);
+          errno = EINVAL;
+          return -1;
+     }
+
+     m->rec = (const journal_rec_t *)((const char *)m->map + sizeof(*hdr));
+     m->n = (m->size - sizeof(*hdr)) / sizeof(journal_rec_t);
+
+     return 0;
+}
+
+void journal_unmap(journal_map_t *m){
+     if(m->map)
+          munmap(m->map, m->size);
+     memset(m, 0, sizeof(*m));
+
+     return;
+}
+
+Bool journal_valid(const journal_rec_t *r){
+     return r->crc == crc32((const char *)r + sizeof(r->crc), sizeof(*r) - sizeof(r->crc));
+}
+
+/* Index of the first record at or after time (ns since the epoch) */
+size_t journal_seek(const journal_map_t *m, int64_t time){
+     size_t lo = 0, hi = m->n, mid;
+
+     while(lo < hi)
+     {
+          mid = lo + (hi - lo) / 2;
+          if(m->rec[mid].time < time)
+               lo = mid + 1;
+          else
+               hi = mid;
+     }
+
+     return lo;
+}
@@ -0,0 +1,136 @@
+/*
+ *      tty-pomodoro event loop.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Every wakeup source (tick timer, signals, terminal input) is a file
+ *      descriptor registered here; loop_once() sleeps in poll() until one
+ *      of them is ready and runs its callback from normal program context.
+ *      The one exception is loop_soft(), a wakeup that may come late.
+ */
+
+#include "ttypomodoro.h"
+
+typedef struct
+{
+     loop_cb_t cb;
+     void *arg;
+} loop_handler_t;
+
+static struct pollfd *pfd;
+static loop_handler_t *handler;
+static int nfd, maxfd;
+
+/* One wakeup on CLOCK_MONOTONIC, 0 for none, run as cb(-1, 0, NULL) */
+static int64_t soft;
+static loop_cb_t soft_cb;
+
+int loop_add(int fd, short events, loop_cb_t cb, void *arg){
+     if(fd < 0)
+          return -1;
+
+     if(nfd == maxfd)
+     {
+          int n = maxfd ? maxfd * 2 : 8;
+          struct pollfd *p = realloc(pfd, n * sizeof(*pfd));
+          loop_handler_t *h;
+
+          if(!p)
+               return -1;
+          pfd = p;
+          if(!(h = realloc(handler, n * sizeof(*handler))))
+               return -1;
+          handler = h;
+          maxfd = n;
+     }
+
+     pfd[nfd].fd = fd;
+     pfd[nfd].events = events;
+     pfd[nfd].revents = 0;
+     handler[nfd].cb = cb;
+     handler[nfd].arg = arg;
+     ++nfd;
+
+     return 0;
+}
+
+/* Slots are only marked here; loop_once() compacts them once dispatch is
+ * over, so callbacks may safely remove any descriptor, including their own. */
+void loop_del(int fd){
+     int i;
+
+     for(i = 0; i < nfd; ++i)
+          if(pfd[i].fd == fd)
+               pfd[i].fd = -1;
+
+     return;
+}
+
+void loop_set_events(int fd, short events){
+     int i;
+
+     for(i = 0; i < nfd; ++i)
+          if(pfd[i].fd == fd)
+               pfd[i].events = events;
+
+     return;
+}
+
+/* Wake up at when for cb, as poll()'s timeout: unlike a timerfd expiry,
+ * that may come up to the timer slack late (PR_SET_TIMERSLACK), for the
+ * kernel to serve it along with other wakeups. A later call replaces it. */
+void loop_soft(int64_t when, loop_cb_t cb){
+     soft = when;
+     soft_cb = cb;
+
+     return;
+}
+
+static void loop_compact(void){
+     int i, j;
+
+     for(i = j = 0; i < nfd; ++i)
+          if(pfd[i].fd >= 0)
+          {
+               pfd[j] = pfd[i];
+               handler[j] = handler[i];
+               ++j;
+          }
+     nfd = j;
+
+     return;
+}
+
+int loop_once(int timeout){
+     int64_t wait;
+     int i, n, ret;
+     Bool due;
+
+     loop_compact();
+
+     if(soft)
+     {
+          wait = MAX(soft - clock_ns(CLOCK_MONOTONIC), 0);
+          wait = MIN((wait + 999999) / 1000000, INT_MAX);
+          if(timeout < 0 || wait < timeout)
+               timeout = wait;
+     }
+
+     ret = poll(pfd, nfd, timeout);
+     due = soft && clock_ns(CLOCK_MONOTONIC) >= soft;
+     if(ret > 0 || due)
+          ++ttyclock->stats.wakeups;
+     if(due)
+     {
+          soft = 0;
+          soft_cb(-1, 0, NULL);
+     }
+     if(ret <= 0)
+          return (ret < 0 && errno != EINTR) ? -1 : 0;
+
+     /* Descriptors added by a callback wait for the next round */
+     for(i = 0, n = nfd; i < n; ++i)
+          if(pfd[i].fd >= 0 && pfd[i].revents)
+               handler[i].cb(pfd[i].fd, pfd[i].revents, handler[i].arg);
+
+     return ret;
+}
@@ -0,0 +1,533 @@
+/*
+ *      tty-pomodoro entry point.
+ *      See ttypomodoro.c for the license detail.
+ */
+
+#include "ttypomodoro.h"
+
+void cleanup(void){
+	int i;
+
+	/* Its windows go with the screen */
+	split_close();
+	for (i = 0; ttyclock && i < ttyclock->nterm; ++i) {
+		term_close(&ttyclock->term[i]);
+		free(ttyclock->term[i].path);
+	}
+	status_close();
+	share_close();
+	config_close();
+	/* Not into a --stream reader */
+	if (ttyclock && ttyclock->remaining.expired && !ttyclock->option.stream)
+		printf("Time ended!\n");
+
+	if (ttyclock && ttyclock->option.format)
+		free(ttyclock->option.format);
+	if (ttyclock) {
+		free(ttyclock->option.socket);
+		free(ttyclock->option.journal);
+		free(ttyclock->option.tag);
+		if (ttyclock->stats.first_frame)
+			fprintf(stderr, "tty-pomodoro: resumed, first frame after %.3f ms.\n",
+				ttyclock->stats.first_frame / 1e6);
+	}
+	if (ttyclock)
+		free(ttyclock);
+}
+
+void print_usage(){
+   printf("usage : tty-clock [-ivcbrahBxnS] [-C [0-7]] [-d delay] [-a nsdelay] [-T tty] [short | long]\n"
+          "                  [-t tag] [--resume] [--ansi] [--scale n|auto] [--fps n] [--metrics path|port]\n"
+          "                  [--cycle spec [--auto] [--schedule]] [--query] [--stream[=fmt]]\n"
+          "                  [--clock boottime|monotonic|virtual] [--script path] [--font path] [--dump-font]\n"
+          "                  [--progress] [--minutes] [--config path] [--split spec]\n"
+          "                  [--bell] [--notify-timeout s] [--notify cmd]... [--daemon] [--socket path] [--timer id|new] [--journal path]\n"
+          "       tty-clock attach [options] [short | long]\n"
+          "       tty-clock report days|weeks|interruptions|streaks|tags\n"
+          "                  [--from YYYY-MM-DD] [--to YYYY-MM-DD] [--format table|csv|json]\n"
+              "    -x            Show box                                       \n"
+              "    -c            Set the timer at the center of the terminal    \n"
+              "    -C [0-7]      Set the clock color                            \n"
+              "    -b            Use bold colors                                \n"
+              "    -T tty        Display the timer on the specified terminal (repeatable)\n"
+              "    -r            Do rebound the timer                           \n"
+              "    --fps n       Frames per second of the rebound animation. Default 30\n"
+              "    -n            Don't quit on keypress                         \n"
+              "    -v            Show tty-pomodoro version                      \n"
+              "    -i            Show some info about tty-pomodoro              \n"
+              "    -h            Show this page                                 \n"
+              "    -B            Enable blinking colon                          \n"
+              "    --minutes     Show hours and minutes left, redrawn every minute ('m')\n"
+              "    --config path Settings, reloaded when they change. Default $XDG_CONFIG_HOME/tty-pomodoro/config\n"
+              "    -d delay      Set the delay between two redraws of the timer . Default 1s. \n"
+              "    -a nsdelay    Additional delay between two redraws in nanoseconds. Default 0ns.\n"
+              "    -S            Pause the timer while the system is suspended  \n"
+              "    --clock c     Count on boottime (default), monotonic (as -S) or a virtual\n"
+              "                  clock run by --script as fast as it draws     \n"
+              "    --script path Commands for the virtual clock: wait s, pause, quit\n"
+              "    --daemon      Serve timers on a Unix socket, without a display\n"
+              "    --socket path Socket of the daemon or of attach. Default $XDG_RUNTIME_DIR/tty-pomodoro.sock\n"
+              "    --timer id    Show timer <id> of the daemon, or a new one with \"new\"\n"
+              "    --journal path Session journal. Default $XDG_DATA_HOME/tty-pomodoro/journal\n"
+              "    -t tag        Tag the session in the journal (8 characters)  \n"
+              "    --resume      Carry on with the timer left by the last run   \n"
+              "    --ansi        Draw with plain ANSI sequences instead of ncurses\n"
+              "    --scale n|auto Digit size, or the largest the terminal fits. Default 1\n"
+              "    --progress    Show how much of the phase is gone, in a bar under the timer\n"
+              "    --split spec  Tile other timers beside this one, e.g. 'standup=15@4,tea=3,break=short'\n"
+              "    --font path   Draw with the glyph atlas at path; 'f' switches fonts\n"
+              "    --dump-font   Write the built-in atlas to stdout, as --font takes it\n"
+              "    --metrics path|port Serve Prometheus metrics on a Unix socket or 127.0.0.1:port\n"
+              "    --cycle spec  Run phases in turn, e.g. '4x(work,short),long' or 'work:50,short:10'\n"
+              "    --auto        Start the next phase of the cycle without waiting for 'p'\n"
+              "    --schedule    Print the next phases of the cycle and their times, then exit\n"
+              "    --query       Print the running timer's phase, time left, state and cycle, then exit\n"
+              "    --stream[=fmt] No display: print a line when the timer changes, as fmt or json\n"
+              "                  (%%p phase, %%n next, %%t mm:ss, %%m, %%s, %%r seconds left, %%S state,\n"
+              "                  %%c cycle, %%T tag). Default \"%%p %%t %%S\"\n"
+              "    --bell        Ring the terminal bell when a phase ends\n"
+              "    --notify cmd  Run sh -c cmd when a phase ends (repeatable)\n"
+              "    --notify-timeout s Kill the --notify hooks given after it at s seconds. Default 10\n"
+              "    attach        Show the timer of an earlier attach, or start one that outlives\n"
+              "                  this terminal. Default socket $XDG_RUNTIME_DIR/tty-pomodoro-attach.sock\n"
+              "    report        Summarise the journal: sessions per day, focus per week,\n"
+              "                  interruption rate, streaks or per tag          \n"
+              "    short         Take a five minute break                       \n"
+              "    long          Take a ten minute break                        \n");
+}
+
+int main(int argc, char **argv){
+     static const struct option long_options[] =
+     {
+          { "daemon", no_argument,       NULL, OPT_DAEMON },
+          { "socket", required_argument, NULL, OPT_SOCKET },
+          { "timer",  required_argument, NULL, OPT_TIMER },
+          { "journal", required_argument, NULL, OPT_JOURNAL },
+          { "from",   required_argument, NULL, OPT_FROM },
+          { "to",     required_argument, NULL, OPT_TO },
+          { "format", required_argument, NULL, OPT_FORMAT },
+          { "resume", no_argument,       NULL, OPT_RESUME },
+          { "ansi",   no_argument,       NULL, OPT_ANSI },
+          { "metrics", required_argument, NULL, OPT_METRICS },
+          { "scale",  required_argument, NULL, OPT_SCALE },
+          { "cycle",  required_argument, NULL, OPT_CYCLE },
+          { "auto",   no_argument,       NULL, OPT_AUTO },
+          { "schedule", no_argument,     NULL, OPT_SCHEDULE },
+          { "bell",   no_argument,       NULL, OPT_BELL },
+          { "notify", required_argument, NULL, OPT_NOTIFY },
+          { "notify-timeout", required_argument, NULL, OPT_NOTIFY_TIMEOUT },
+          { "fps",    required_argument, NULL, OPT_FPS },
+          { "query",  no_argument,       NULL, OPT_QUERY },
+          { "stream", optional_argument, NULL, OPT_STREAM },
+          { "clock",  required_argument, NULL, OPT_CLOCK },
+          { "script", required_argument, NULL, OPT_SCRIPT },
+          { "font",   required_argument, NULL, OPT_FONT },
+          { "dump-font", no_argument,    NULL, OPT_DUMP_FONT },
+          { "progress", no_argument,     NULL, OPT_PROGRESS },
+          { "minutes", no_argument,      NULL, OPT_MINUTES },
+          { "config", required_argument, NULL, OPT_CONFIG },
+          { "split",  required_argument, NULL, OPT_SPLIT },
+          { NULL, 0, NULL, 0 }
+     };
+     int c, i;
+     int64_t length, notify_timeout = NOTIFY_TIMEOUT;
+     Bool daemon = False, resume = False, schedule = False, simulate = False, attach = False;
+     char *timer = NULL, *metrics = NULL, *cycle = NULL, *script = NULL, *split = NULL;
+     int64_t started = clock_ns(CLOCK_MONOTONIC);
+
+     /* Alloc ttyclock */
+     ttyclock = malloc(sizeof(ttyclock_t));
+     assert(ttyclock != NULL);
+     memset(ttyclock, 0, sizeof(ttyclock_t));
+     ttyclock->stats.started = started;
+
+     ttyclock->option.date = True;
+
+     /* Date format */
+     ttyclock->option.format = malloc(sizeof(char) * 100);
+     /* Default date format */
+     strncpy(ttyclock->option.format, "%F", 100);
+     /* Default color */
+     ttyclock->option.color = COLOR_RED; 
+     /* Default delay */
+     ttyclock->option.delay = 1; /* 1FPS */
+     ttyclock->option.nsdelay = 0; /* -0FPS */
+     ttyclock->option.blink = False;
+     ttyclock->option.scale = 1;
+     ttyclock->option.fps = REBOUND_FPS;
+
+     /* Never show seconds */
+     ttyclock->option.second = False;
+
+     /* Hide the date */
+     ttyclock->option.date = False;
+
+     atexit(cleanup);
+
+     /* The config file, for the flags to override */
+     for (i = 1; i < argc; ++i)
+          if (!strcmp(argv[i], "--config") && i + 1 < argc)
+               ttyclock->option.config = argv[i + 1];
+          else if (!strncmp(argv[i], "--config=", 9))
+               ttyclock->option.config = argv[i] + 9;
+     config_load();
+
+     while ((c = getopt_long(argc, argv, "ivcbrhBxnSC:d:T:a:t:", long_options, NULL)) != -1){
+          switch(c)
+          {
+          case 'h':
+          default:
+               print_usage();
+               exit(EXIT_SUCCESS);
+               break;
+          case 'i':
+               puts("TTY-Clock 2 © by Martin Duquesnoy (xorg62@gmail.com), Grey (grey@greytheory.net)");
+               exit(EXIT_SUCCESS);
+               break;
+          case 'v':
+               puts("TTY-Clock 2 © devel version");
+               exit(EXIT_SUCCESS);
+               break;
+          case 'c':
+               ttyclock->option.center = True;
+               break;
+          case 'b':
+               ttyclock->option.bold = True;
+               break;
+          case 'C':
+               if(atoi(optarg) >= 0 && atoi(optarg) < 8)
+                    ttyclock->option.color = atoi(optarg);
+               break;
+          case 'r':
+               ttyclock->option.rebound = True;
+               break;
+          case 'd':
+               if(atol(optarg) >= 0 && atol(optarg) < 100)
+                    ttyclock->option.delay = atol(optarg);
+               break;
+          case 'B':
+               ttyclock->option.blink = True;
+               break;
+          case 'a':
+               if(atol(optarg) >= 0 && atol(optarg) < 1000000000)
+                    ttyclock->option.nsdelay = atol(optarg);
+                break;
+          case 'x':
+               ttyclock->option.box = True;
+               break;
+	  case 'T': {
+	       struct stat sbuf;
+	       if (stat(optarg, &sbuf) == -1) {
+		       fprintf(stderr, "tty-clock: error: couldn't stat '%s': %s.\n",
+				       optarg, strerror(errno));
+		       exit(EXIT_FAILURE);
+	       } else if (!S_ISCHR(sbuf.st_mode)) {
+		       fprintf(stderr, "tty-clock: error: '%s' doesn't appear to be a character device.\n",
+				       optarg);
+		       exit(EXIT_FAILURE);
+	       } else if (ttyclock->nterm == MAXTERMS) {
+		       fprintf(stderr, "tty-clock: error: at most %d terminals can be given with -T.\n",
+				       MAXTERMS);
+		       exit(EXIT_FAILURE);
+	       } else {
+			ttyclock->term[ttyclock->nterm++].path = strdup(optarg);
+	       }}
+	       break;
+	  case 'n':
+	       ttyclock->option.noquit = True;
+	       break;
+          case 'S':
+               ttyclock->option.suspend = True;
+               break;
+          case OPT_DAEMON:
+               daemon = True;
+               break;
+          case OPT_SOCKET:
+               free(ttyclock->option.socket);
+               ttyclock->option.socket = strdup(optarg);
+               break;
+          case OPT_TIMER:
+               timer = optarg;
+               break;
+          case OPT_JOURNAL:
+               free(ttyclock->option.journal);
+               ttyclock->option.journal = strdup(optarg);
+               break;
+          case 't':
+               free(ttyclock->option.tag);
+               ttyclock->option.tag = strdup(optarg);
+               break;
+          case OPT_FROM:
+               ttyclock->option.from = optarg;
+               break;
+          case OPT_TO:
+               ttyclock->option.to = optarg;
+               break;
+          case OPT_FORMAT:
+               ttyclock->option.report_format = optarg;
+               break;
+          case OPT_RESUME:
+               resume = True;
+               break;
+          case OPT_ANSI:
+               ttyclock->option.ansi = True;
+               break;
+          case OPT_METRICS:
+               metrics = optarg;
+               break;
+          case OPT_CYCLE:
+               cycle = optarg;
+               break;
+          case OPT_AUTO:
+               ttyclock->option.autoadvance = True;
+               break;
+          case OPT_SCHEDULE:
+               schedule = True;
+               break;
+          case OPT_BELL:
+               ttyclock->option.bell = True;
+               break;
+          case OPT_NOTIFY:
+               if (notify_add(optarg, notify_timeout) < 0)
+               {
+                    fprintf(stderr, "tty-pomodoro: error: at most %d --notify hooks.\n", NOTIFY_HOOKS);
+                    exit(EXIT_FAILURE);
+               }
+               break;
+          case OPT_NOTIFY_TIMEOUT:
+               if (atoi(optarg) > 0)
+                    notify_timeout = (int64_t)atoi(optarg) * NSEC_PER_SEC;
+               break;
+          case OPT_SCALE:
+               if(!strcmp(optarg, "auto"))
+                    ttyclock->option.scale = 0;
+               else if(atoi(optarg) >= 1 && atoi(optarg) <= MAXSCALE)
+                    ttyclock->option.scale = atoi(optarg);
+               break;
+          case OPT_QUERY:
+               /* Before anything else: no terminal, no journal */
+               exit(status_query());
+          case OPT_STREAM:
+               ttyclock->option.stream = optarg ? optarg : STREAM_FORMAT;
+               break;
+          case OPT_FPS:
+               if(atoi(optarg) >= 1 && atoi(optarg) <= MAXFPS)
+                    ttyclock->option.fps = atoi(optarg);
+               break;
+          case OPT_CLOCK:
+               simulate = !strcmp(optarg, "virtual");
+               if(!strcmp(optarg, "boottime") || !strcmp(optarg, "monotonic"))
+                    ttyclock->option.suspend = !strcmp(optarg, "monotonic");
+               else if(!simulate)
+               {
+                    fprintf(stderr, "tty-pomodoro: error: --clock is boottime, monotonic or virtual.\n");
+                    exit(EXIT_FAILURE);
+               }
+               break;
+          case OPT_SCRIPT:
+               script = optarg;
+               break;
+          case OPT_FONT:
+               if(font_load(optarg) < 0)
+               {
+                    fprintf(stderr, "tty-pomodoro: error: couldn't load the font '%s': %s.\n",
+                            optarg, strerror(errno));
+                    exit(EXIT_FAILURE);
+               }
+               ttyclock->option.font = 1;
+               break;
+          case OPT_DUMP_FONT:
+               exit(font_dump());
+          case OPT_PROGRESS:
+               ttyclock->option.progress = True;
+               break;
+          case OPT_MINUTES:
+               ttyclock->option.minutes = True;
+               break;
+          case OPT_CONFIG:
+               /* Read before the flags */
+               break;
+          case OPT_SPLIT:
+               split = optarg;
+               break;
+          }
+     }
+
+     if (daemon)
+          return daemon_run();
+
+     if (optind < argc && !strcmp(argv[optind], "report"))
+          return report_run(optind + 1 < argc ? argv[optind + 1] : NULL);
+
+     /* attach [short | long] */
+     if (optind < argc && !strcmp(argv[optind], "attach")){
+        attach = True;
+        ++optind;
+     }
+
+     /* Set the default minutes to 25 */
+     length = phase_length(PHASE_WORK);
+
+     /* A cycle of phases, or check if short or long break */
+     if (cycle){
+        if (timer || schedule_parse(cycle) < 0){
+            fprintf(stderr, "tty-pomodoro: error: %s.\n",
+                    timer ? "--cycle runs locally, not with --timer" : "bad --cycle spec");
+            exit(EXIT_FAILURE);
+        }
+        length = schedule_begin();
+     }else if (optind < argc){
+        char *argument = argv[optind];
+        if (!strcmp(argument, "short")){
+            length = phase_length(PHASE_SHORT);
+            ttyclock->phase = PHASE_SHORT;
+        }else if (!strcmp(argument, "long")){
+            length = phase_length(PHASE_LONG);
+            ttyclock->phase = PHASE_LONG;
+        }else{
+            printf("Command not recognized\n");
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+     }
+
+     /* A simulation is played on its own, leaving no trace of it */
+     if (simulate && (!script || timer || resume || sim_load(script) < 0)){
+        if (!script || timer || resume)
+            fprintf(stderr, "tty-pomodoro: error: --clock virtual takes a --script, "
+                    "and no --timer or --resume.\n");
+        exit(EXIT_FAILURE);
+     }
+
+     /* The tiles take one ncurses terminal to themselves */
+     if (split){
+        if (ttyclock->nterm || ttyclock->option.ansi || ttyclock->option.stream || attach
+            || timer || simulate || ttyclock->option.progress){
+            fprintf(stderr, "tty-pomodoro: error: --split draws on one ncurses terminal: not with "
+                    "-T, --ansi, --stream, attach, --timer, --clock virtual or --progress.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (split_parse(split) < 0){
+            fprintf(stderr, "tty-pomodoro: error: bad --split spec.\n");
+            exit(EXIT_FAILURE);
+        }
+        /* Nothing to bounce */
+        ttyclock->option.rebound = False;
+     }
+
+     /* Count time spent suspended unless asked to pause through it */
+     countdown_start(&ttyclock->countdown,
+                     simulate ? CLOCK_VIRTUAL
+                     : ttyclock->option.suspend ? CLOCK_MONOTONIC : CLOCK_BOOTTIME,
+                     length);
+
+     if (schedule){
+        if (!cycle){
+            fprintf(stderr, "tty-pomodoro: error: --schedule needs --cycle.\n");
+            exit(EXIT_FAILURE);
+        }
+        /* Where the interrupted cycle stands, without touching it */
+        if (resume && (checkpoint_open() < 0 || checkpoint_restore() < 0)){
+            fprintf(stderr, "tty-pomodoro: error: no timer to resume.\n");
+            exit(EXIT_FAILURE);
+        }
+        schedule_begin();
+        schedule_plan();
+        schedule_print();
+        return 0;
+     }
+
+     /* Or view the timer of an earlier attach, started here if there is
+      * none; the process that runs it goes on from here too, headless */
+     if (attach && (timer || simulate || share_attach() < 0))
+     {
+          if (timer || simulate)
+               fprintf(stderr, "tty-pomodoro: error: attach takes no --timer or --clock virtual.\n");
+          else
+               fprintf(stderr, "tty-pomodoro: error: can't attach on '%s': %s.\n",
+                       share_path(), strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+
+     /* Or mirror a timer owned by the daemon */
+     if (timer && client_attach(timer, ttyclock->countdown.length) < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: can't attach to timer '%s' on '%s'.\n",
+                  timer, socket_path());
+          exit(EXIT_FAILURE);
+     }
+
+     /* The daemon keeps the record and checkpoint of its own timers, the
+      * attached timer of its own, and a simulation none */
+     if (!timer && !share_viewing())
+     {
+          if (!simulate)
+               checkpoint_open();
+          if (resume && checkpoint_restore() < 0)
+          {
+               fprintf(stderr, "tty-pomodoro: error: no timer to resume.\n");
+               exit(EXIT_FAILURE);
+          }
+          /* The restored position, or the first phase */
+          if (cycle)
+          {
+               schedule_begin();
+               schedule_plan();
+          }
+          checkpoint_save();
+          if (!simulate && journal_open() == 0)
+               journal_append(resume ? JOURNAL_RESUME : JOURNAL_START);
+     }
+
+     /* Status bars go without rather than the timer */
+     if (!simulate && !share_viewing())
+          status_open();
+     init_events();
+     /* A script plays the same whatever the file says later */
+     if (!simulate)
+          config_watch();
+     /* A viewer only rings the bell; the hooks run with the timer */
+     if (!share_viewing() && notify_start() < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: can't start the notification worker: %s.\n",
+                  strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+     if (metrics && !share_viewing() && metrics_listen(metrics) < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: can't serve metrics on '%s': %s.\n",
+                  metrics, strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+     /* No terminal, nor init() to set us running */
+     if (ttyclock->option.stream || share_serving())
+     {
+          ttyclock->running = True;
+          if (ttyclock->option.stream)
+               stream_open();
+     }
+     else
+     {
+          if (ttyclock->option.progress)
+               progress_open();
+          init_terms();
+          if (split_active())
+               split_open();
+     }
+     update_hour();
+     draw_terms();
+     if (resume)
+          ttyclock->stats.first_frame = clock_ns(CLOCK_MONOTONIC) - started;
+     arm_timer();
+     arm_rebound();
+     if (simulate)
+          sim_run();
+     while(ttyclock->running)
+          loop_once(-1);
+
+     /* Left before the end */
+     journal_append(JOURNAL_INTERRUPT);
+     journal_close();
+
+     return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ *      tty-pomodoro metrics endpoint (--metrics).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Serves ttyclock->stats in the Prometheus text format, as a plain
+ *      HTTP/1.0 response, on a Unix socket or a loopback TCP port:
+ *
+ *        --metrics /run/user/1000/tty-pomodoro.metrics
+ *        --metrics 9464          (127.0.0.1:9464)
+ *
+ *      The counters are plain integers only ever touched by the loop
+ *      thread, which also answers the scrapes: there is nothing to lock
+ *      or synchronise, and keeping them always on costs an increment per
+ *      event plus two clock reads around update_hour() and draw_clock().
+ */
+
+#include "ttypomodoro.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdarg.h>
+
+#define METRICS_OUT 16384
+
+/* Upper bounds of the tick lateness buckets, ns */
+static const int64_t late_bound[METRICS_BUCKETS] =
+{
+     10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000, 100000000
+};
+
+static char out[METRICS_OUT];
+static size_t outlen;
+
+/* Count a tick that fired ns after it was due */
+void metrics_late(int64_t ns){
+     int i;
+
+     if(ns < 0)
+          ns = 0;
+     for(i = 0; i < METRICS_BUCKETS && ns > late_bound[i]; ++i);
+     ++ttyclock->stats.late[i];
+     ttyclock->stats.late_ns += ns;
+     ++ttyclock->stats.ticks;
+
+     return;
+}
+
+static void emit(const char *fmt, ...){
+     va_list ap;
+     int n;
+
+     va_start(ap, fmt);
+     n = vsnprintf(out + outlen, sizeof(out) - outlen, fmt, ap);
+     va_end(ap);
+     if(n > 0)
+          outlen = MIN(outlen + n, sizeof(out) - 1);
+
+     return;
+}
+
+static void counter(const char *name, const char *help, unsigned long v){
+     emit("# HELP tty_pomodoro_%s %s\n# TYPE tty_pomodoro_%s counter\ntty_pomodoro_%s %lu\n",
+          name, help, name, name, v);
+
+     return;
+}
+
+static void render(void){
+     const term_t *t;
+     const schedule_t *sp;
+     notify_stats_t ns;
+     unsigned long n = 0;
+     int i, nplan;
+
+     outlen = 0;
+     emit("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n");
+
+     counter("wakeups_total", "Returns from poll() with events.", ttyclock->stats.wakeups);
+     emit("# HELP tty_pomodoro_wakeups_per_hour Wakeups an hour since the start.\n"
+          "# TYPE tty_pomodoro_wakeups_per_hour gauge\ntty_pomodoro_wakeups_per_hour %.1f\n",
+          ttyclock->stats.wakeups * 3600e9 / MAX(clock_ns(CLOCK_MONOTONIC) - ttyclock->stats.started, 1));
+     emit("# HELP tty_pomodoro_tick_interval_seconds Time between two redraws, 0 for none before"
+          " the end of the phase.\n"
+          "# TYPE tty_pomodoro_tick_interval_seconds gauge\ntty_pomodoro_tick_interval_seconds %g\n",
+          tick_unit() / 1e9);
+     counter("frames_total", "Frames drawn, summed over terminals.", ttyclock->stats.frames);
+     counter("cells_total", "Cells repainted.", ttyclock->stats.cells);
+     counter("keys_total", "Keys handled by key_event().", ttyclock->stats.keys);
+     counter("winches_total", "SIGWINCH received.", ttyclock->stats.winches);
+     counter("resizes_total", "Terminal resizes applied, after folding SIGWINCH bursts.",
+             ttyclock->stats.resizes);
+     counter("rebound_frames_total", "Rebound animation frames.", ttyclock->stats.rebound_frames);
+     counter("rebound_bytes_total", "Bytes written by rebound animation frames (-T and --ansi terminals).",
+             ttyclock->stats.rebound_bytes);
+     counter("stream_lines_total", "--stream lines written.", ttyclock->stats.stream_lines);
+     counter("stream_dropped_total", "--stream lines replaced by a newer one before stdout took them.",
+             ttyclock->stats.stream_dropped);
+     counter("progress_frames_total", "--progress bar updates between ticks.",
+             ttyclock->stats.progress_frames);
+     counter("progress_bytes_total", "Bytes written by them (-T and --ansi terminals).",
+             ttyclock->stats.progress_bytes);
+     emit("# HELP tty_pomodoro_viewers Viewers attached to this timer.\n"
+          "# TYPE tty_pomodoro_viewers gauge\ntty_pomodoro_viewers %lu\n", ttyclock->stats.share_viewers);
+     counter("share_events_total", "Timer changes sent to the viewers, each formatted once.",
+             ttyclock->stats.share_events);
+     counter("share_bytes_total", "Bytes sent to the viewers.", ttyclock->stats.share_bytes);
+     counter("share_resyncs_total", "Viewers sent a snapshot for changes they were too slow to take.",
+             ttyclock->stats.share_resyncs);
+     counter("config_reloads_total", "Config file changes applied.", ttyclock->stats.config_reloads);
+     counter("config_errors_total", "Config file changes refused for a bad line.",
+             ttyclock->stats.config_errors);
+     counter("split_layouts_total", "--split layouts computed, at the start and on resizes.",
+             ttyclock->stats.split_layouts);
+     counter("split_tiles_total", "--split timer tiles repainted.", ttyclock->stats.split_tiles);
+     emit("# HELP tty_pomodoro_rebound_cpu_seconds_total CPU time spent in rebound animation frames.\n"
+          "# TYPE tty_pomodoro_rebound_cpu_seconds_total counter\n"
+          "tty_pomodoro_rebound_cpu_seconds_total %.9f\n", ttyclock->stats.rebound_ns / 1e9);
+     emit("# HELP tty_pomodoro_update_seconds_total Time spent in update_hour().\n"
+          "# TYPE tty_pomodoro_update_seconds_total counter\n"
+          "tty_pomodoro_update_seconds_total %.9f\n", ttyclock->stats.update_ns / 1e9);
+     emit("# HELP tty_pomodoro_draw_seconds_total Time spent in draw_clock().\n"
+          "# TYPE tty_pomodoro_draw_seconds_total counter\n"
+          "tty_pomodoro_draw_seconds_total %.9f\n", ttyclock->stats.draw_ns / 1e9);
+
+     emit("# HELP tty_pomodoro_bytes_total Bytes written to a terminal by tty-pomodoro itself"
+          " (-T and --ansi terminals).\n# TYPE tty_pomodoro_bytes_total counter\n");
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          emit("tty_pomodoro_bytes_total{tty=\"%s\"} %lu\n", t->path ? t->path : "-", t->stats.bytes);
+     }
+     emit("# HELP tty_pomodoro_frames_dropped_total Frames skipped for a terminal behind on output.\n"
+          "# TYPE tty_pomodoro_frames_dropped_total counter\n");
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          emit("tty_pomodoro_frames_dropped_total{tty=\"%s\"} %lu\n", t->path ? t->path : "-", t->stats.dropped);
+     }
+
+     notify_get_stats(&ns);
+     counter("notify_events_total", "Phase end events queued for the --notify hooks.", ns.queued);
+     counter("notify_dropped_total", "Events dropped on a full notification queue.", ns.dropped);
+     counter("notify_spawned_total", "Hooks started.", ns.spawned);
+     counter("notify_skipped_total", "Hooks skipped, still running or rate limited.", ns.skipped);
+     counter("notify_failed_total", "Hooks that failed to start or exited non-zero.", ns.failed);
+     counter("notify_timedout_total", "Hooks killed at their timeout.", ns.timedout);
+     emit("# HELP tty_pomodoro_notify_latency_seconds_total Time from queueing to starting hooks.\n"
+          "# TYPE tty_pomodoro_notify_latency_seconds_total counter\n"
+          "tty_pomodoro_notify_latency_seconds_total %.9f\n"
+          "# HELP tty_pomodoro_notify_latency_max_seconds Longest time from queueing to starting a hook.\n"
+          "# TYPE tty_pomodoro_notify_latency_max_seconds gauge\n"
+          "tty_pomodoro_notify_latency_max_seconds %.9f\n",
+          ns.latency_ns / 1e9, ns.latency_max_ns / 1e9);
+
+     emit("# HELP tty_pomodoro_schedule_end_timestamp_seconds End of the running and planned --cycle phases.\n"
+          "# TYPE tty_pomodoro_schedule_end_timestamp_seconds gauge\n");
+     sp = schedule_get(&nplan);
+     for(i = 0; i < nplan; ++i, ++sp)
+          emit("tty_pomodoro_schedule_end_timestamp_seconds{step=\"%d\",phase=\"%s\",firm=\"%d\"} %.3f\n",
+               i, schedule_phase_name(sp->phase), sp->firm ? 1 : 0,
+               (clock_ns(CLOCK_REALTIME) + sp->end - clock_ns(ttyclock->countdown.clock)) / 1e9);
+
+     emit("# HELP tty_pomodoro_tick_lateness_seconds Delay between a tick's due time and its handling.\n"
+          "# TYPE tty_pomodoro_tick_lateness_seconds histogram\n");
+     for(i = 0; i < METRICS_BUCKETS; ++i)
+     {
+          n += ttyclock->stats.late[i];
+          emit("tty_pomodoro_tick_lateness_seconds_bucket{le=\"%g\"} %lu\n", late_bound[i] / 1e9, n);
+     }
+     emit("tty_pomodoro_tick_lateness_seconds_bucket{le=\"+Inf\"} %lu\n"
+          "tty_pomodoro_tick_lateness_seconds_sum %.9f\n"
+          "tty_pomodoro_tick_lateness_seconds_count %lu\n",
+          ttyclock->stats.ticks, ttyclock->stats.late_ns / 1e9, ttyclock->stats.ticks);
+
+     return;
+}
+
+/* Answer whatever request comes in with the metrics, then hang up */
+static void metrics_client(int fd, short revents, void *arg){
+     char req[1024];
+     size_t off = 0;
+     ssize_t n;
+
+     if(read(fd, req, sizeof(req)) > 0)
+     {
+          render();
+          while(off < outlen && (n = write(fd, out + off, outlen - off)) > 0)
+               off += n;
+     }
+
+     loop_del(fd);
+     close(fd);
+
+     return;
+}
+
+static void metrics_accept(int fd, short revents, void *arg){
+     int cfd;
+
+     while((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+          loop_add(cfd, POLLIN, metrics_client, NULL);
+
+     return;
+}
+
+/* Listen on a socket path, or on a port of 127.0.0.1 */
+int metrics_listen(const char *spec){
+     struct sockaddr_un sun;
+     struct sockaddr_in sin;
+     struct sockaddr *sa;
+     struct stat st;
+     socklen_t len;
+     char *end;
+     long port;
+     int fd, one = 1;
+
+     port = strtol(spec, &end, 10);
+     if(!*end && port > 0 && port < 65536)
+     {
+          memset(&sin, 0, sizeof(sin));
+          sin.sin_family = AF_INET;
+          sin.sin_port = htons(port);
+          sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+          sa = (struct sockaddr *)&sin;
+          len = sizeof(sin);
+     }
+     else
+     {
+          memset(&sun, 0, sizeof(sun));
+          sun.sun_family = AF_UNIX;
+          if(strlen(spec) >= sizeof(sun.sun_path))
+          {
+               errno = ENAMETOOLONG;
+               return -1;
+          }
+          strcpy(sun.sun_path, spec);
+          /* A socket left by an earlier run, never any other file */
+          if(stat(spec, &st) == 0 && S_ISSOCK(st.st_mode))
+               unlink(spec);
+          sa = (struct sockaddr *)&sun;
+          len = sizeof(sun);
+     }
+
+     if((fd = socket(sa->sa_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0)
+          return -1;
+     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+     if(bind(fd, sa, len) < 0 || listen(fd, 16) < 0)
+     {
+          close(fd);
+          return -1;
+     }
+     loop_add(fd, POLLIN, metrics_accept, NULL);
+
+     return 0;
+}
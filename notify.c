@@ -0,0 +1,377 @@
+/*
+ *      tty-pomodoro notifications (--bell, --notify).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      When a phase ends the loop thread rings the terminal bell itself
+ *      and queues the event for the hooks; that is all it does. A worker
+ *      thread takes events off the bounded queue and runs each hook with
+ *      posix_spawn() as `sh -c cmd`, the event in its environment:
+ *
+ *        TTY_POMODORO_EVENT   end
+ *        TTY_POMODORO_PHASE   phase that ended: work, short or long
+ *        TTY_POMODORO_NEXT    phase that follows, empty after the last one
+ *        TTY_POMODORO_TAG     the -t tag
+ *
+ *      Hooks get /dev/null for stdio, their own process group, an empty
+ *      signal mask and default dispositions, so none of the signals the
+ *      loop keeps blocked for its signalfd stay blocked in them. A hook
+ *      still running at its timeout is killed with its group. One still
+ *      running when the next event comes, or past its rate limit
+ *      (NOTIFY_BURST runs, then one per NOTIFY_REFILL), is skipped, and a
+ *      full queue drops the event: a hanging hook costs hooks, not ticks.
+ */
+
+#include "ttypomodoro.h"
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define NOTIFY_QUEUE  16
+#define NOTIFY_BURST  5
+#define NOTIFY_REFILL (60 * NSEC_PER_SEC)
+/* Reap without a pidfd this often */
+#define NOTIFY_POLL_MS 100
+
+extern char **environ;
+
+typedef struct
+{
+     phase_t phase, next;
+     Bool last;
+     /* CLOCK_MONOTONIC when queued */
+     int64_t time;
+} notify_event_t;
+
+typedef struct
+{
+     char *cmd;
+     int64_t timeout;
+     /* The running instance, if any */
+     pid_t pid;
+     int pidfd;
+     int64_t kill_at;
+     Bool killed;
+     /* Rate limit: run time earned, NOTIFY_REFILL per run */
+     int64_t credit, credit_at;
+} notify_hook_t;
+
+static notify_hook_t hook[NOTIFY_HOOKS];
+static int nhook;
+
+/* Queue and stats, shared with the worker */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static notify_event_t queue[NOTIFY_QUEUE];
+static unsigned int head, tail;
+static notify_stats_t stats;
+static Bool stopping;
+
+static pthread_t worker_thread;
+static int wakefd = -1;
+
+/* Run cmd on the events to come, killed after timeout ns */
+int notify_add(const char *cmd, int64_t timeout){
+     if(nhook == NOTIFY_HOOKS)
+          return -1;
+
+     hook[nhook].cmd = strdup(cmd);
+     hook[nhook].timeout = timeout;
+     hook[nhook].pidfd = -1;
+     hook[nhook].credit = NOTIFY_BURST * NOTIFY_REFILL;
+     ++nhook;
+
+     return 0;
+}
+
+static Bool rate_ok(notify_hook_t *h, int64_t now){
+     if(h->credit_at)
+          h->credit = MIN(h->credit + (now - h->credit_at), NOTIFY_BURST * NOTIFY_REFILL);
+     h->credit_at = now;
+     if(h->credit < NOTIFY_REFILL)
+          return False;
+     h->credit -= NOTIFY_REFILL;
+
+     return True;
+}
+
+static void spawn(notify_hook_t *h, const notify_event_t *ev){
+     static const char *name[] = { "work", "short", "long" };
+     posix_spawn_file_actions_t fa;
+     posix_spawnattr_t attr;
+     sigset_t none, all;
+     char var[4][64];
+     char **env;
+     int i, n, err;
+
+     for(n = 0; environ[n]; ++n);
+     if(!(env = malloc((n + 5) * sizeof(*env))))
+          return;
+     memcpy(env, environ, n * sizeof(*env));
+     snprintf(var[0], sizeof(var[0]), "TTY_POMODORO_EVENT=end");
+     snprintf(var[1], sizeof(var[1]), "TTY_POMODORO_PHASE=%s", name[ev->phase]);
+     snprintf(var[2], sizeof(var[2]), "TTY_POMODORO_NEXT=%s", ev->last ? "" : name[ev->next]);
+     snprintf(var[3], sizeof(var[3]), "TTY_POMODORO_TAG=%.8s",
+              ttyclock->option.tag ? ttyclock->option.tag : "");
+     for(i = 0; i < 4; ++i)
+          env[n++] = var[i];
+     env[n] = NULL;
+
+     sigemptyset(&none);
+     sigfillset(&all);
+     posix_spawnattr_init(&attr);
+     posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF
+                              | POSIX_SPAWN_SETPGROUP);
+     posix_spawnattr_setsigmask(&attr, &none);
+     posix_spawnattr_setsigdefault(&attr, &all);
+     posix_spawnattr_setpgroup(&attr, 0);
+     posix_spawn_file_actions_init(&fa);
+     posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+     posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+     posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+
+     err = posix_spawn(&h->pid, "/bin/sh", &fa, &attr,
+                       (char *[]){ "sh", "-c", h->cmd, NULL }, env);
+
+     posix_spawn_file_actions_destroy(&fa);
+     posix_spawnattr_destroy(&attr);
+     free(env);
+
+     pthread_mutex_lock(&lock);
+     if(err)
+     {
+          h->pid = 0;
+          ++stats.failed;
+     }
+     else
+     {
+          ++stats.spawned;
+          stats.latency_ns += clock_ns(CLOCK_MONOTONIC) - ev->time;
+          stats.latency_max_ns = MAX(stats.latency_max_ns, clock_ns(CLOCK_MONOTONIC) - ev->time);
+     }
+     pthread_mutex_unlock(&lock);
+     if(err)
+          return;
+
+     h->pidfd = syscall(SYS_pidfd_open, h->pid, 0);
+     h->kill_at = clock_ns(CLOCK_MONOTONIC) + h->timeout;
+     h->killed = False;
+
+     return;
+}
+
+/* Collect the hooks that are done, kill those out of time */
+static void reap(int64_t now){
+     notify_hook_t *h;
+     int i, status;
+
+     for(i = 0; i < nhook; ++i)
+     {
+          h = &hook[i];
+          if(!h->pid)
+               continue;
+
+          if(waitpid(h->pid, &status, WNOHANG) == h->pid)
+          {
+               pthread_mutex_lock(&lock);
+               if(!h->killed && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+                    ++stats.failed;
+               pthread_mutex_unlock(&lock);
+               if(h->pidfd >= 0)
+                    close(h->pidfd);
+               h->pidfd = -1;
+               h->pid = 0;
+          }
+          else if(!h->killed && now >= h->kill_at)
+          {
+               kill(-h->pid, SIGKILL);
+               h->killed = True;
+               pthread_mutex_lock(&lock);
+               ++stats.timedout;
+               pthread_mutex_unlock(&lock);
+          }
+     }
+
+     return;
+}
+
+static void dispatch(const notify_event_t *ev){
+     int64_t now = clock_ns(CLOCK_MONOTONIC);
+     int i;
+
+     for(i = 0; i < nhook; ++i)
+     {
+          if(hook[i].pid || !rate_ok(&hook[i], now))
+          {
+               pthread_mutex_lock(&lock);
+               ++stats.skipped;
+               pthread_mutex_unlock(&lock);
+               continue;
+          }
+          spawn(&hook[i], ev);
+     }
+
+     return;
+}
+
+static void *worker(void *arg){
+     struct pollfd p[NOTIFY_HOOKS + 1];
+     notify_event_t ev;
+     uint64_t v;
+     int64_t now, wait;
+     int i, n, timeout;
+     Bool stop, more;
+
+     for(;;)
+     {
+          /* Sleep until an event, a hook exiting or the next kill */
+          now = clock_ns(CLOCK_MONOTONIC);
+          p[0].fd = wakefd;
+          p[0].events = POLLIN;
+          timeout = -1;
+          for(i = 0, n = 1; i < nhook; ++i)
+          {
+               if(!hook[i].pid)
+                    continue;
+               if(hook[i].pidfd < 0)
+                    wait = NOTIFY_POLL_MS * 1000000L;
+               else
+               {
+                    p[n].fd = hook[i].pidfd;
+                    p[n++].events = POLLIN;
+                    wait = hook[i].killed ? -1 : MAX(hook[i].kill_at - now, 0);
+               }
+               if(wait >= 0 && (timeout < 0 || wait / 1000000 + 1 < timeout))
+                    timeout = wait / 1000000 + 1;
+          }
+          if(poll(p, n, timeout) < 0 && errno != EINTR)
+               break;
+          if(p[0].revents & POLLIN)
+               while(read(wakefd, &v, sizeof(v)) > 0);
+
+          reap(clock_ns(CLOCK_MONOTONIC));
+
+          for(;;)
+          {
+               pthread_mutex_lock(&lock);
+               if((more = (head != tail)))
+                    ev = queue[head++ % NOTIFY_QUEUE];
+               stop = stopping;
+               pthread_mutex_unlock(&lock);
+               if(!more)
+                    break;
+               dispatch(&ev);
+          }
+          /* Hooks still running go on by themselves */
+          if(stop)
+               break;
+     }
+
+     return NULL;
+}
+
+/* Start the worker, with every signal blocked: they are the loop's */
+int notify_start(void){
+     sigset_t all, old;
+     int err;
+
+     if(!nhook)
+          return 0;
+     if((wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+          return -1;
+
+     sigfillset(&all);
+     pthread_sigmask(SIG_SETMASK, &all, &old);
+     err = pthread_create(&worker_thread, NULL, worker, NULL);
+     pthread_sigmask(SIG_SETMASK, &old, NULL);
+     if(err)
+     {
+          errno = err;
+          close(wakefd);
+          wakefd = -1;
+          return -1;
+     }
+
+     return 0;
+}
+
+/* Ring the bell on every terminal */
+static void bell(void){
+     term_t *t;
+     int i;
+
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          if(t->dead)
+               continue;
+          term_select(t);
+          if(ttyclock->option.ansi)
+               ansi_bell();
+          else
+               beep();
+          term_flush(t);
+     }
+
+     return;
+}
+
+/* The running phase is over; next is the one after it unless last */
+void notify_phase_end(phase_t phase, phase_t next, Bool last){
+     uint64_t one = 1;
+
+     if(ttyclock->option.bell)
+          bell();
+     if(wakefd < 0)
+          return;
+
+     pthread_mutex_lock(&lock);
+     if(tail - head == NOTIFY_QUEUE)
+          ++stats.dropped;
+     else
+     {
+          queue[tail % NOTIFY_QUEUE] = (notify_event_t){ phase, next, last, clock_ns(CLOCK_MONOTONIC) };
+          ++tail;
+          ++stats.queued;
+     }
+     pthread_mutex_unlock(&lock);
+     if(write(wakefd, &one, sizeof(one)) < 0)
+          return;
+
+     return;
+}
+
+/* Let the worker start the hooks of queued events, for up to wait ns */
+void notify_stop(int64_t wait){
+     struct timespec ts;
+     uint64_t one = 1;
+     int64_t until;
+
+     if(wakefd < 0)
+          return;
+
+     pthread_mutex_lock(&lock);
+     stopping = True;
+     pthread_mutex_unlock(&lock);
+     if(write(wakefd, &one, sizeof(one)) < 0)
+          return;
+
+     until = clock_ns(CLOCK_REALTIME) + wait;
+     ts.tv_sec = until / NSEC_PER_SEC;
+     ts.tv_nsec = until % NSEC_PER_SEC;
+     if(pthread_timedjoin_np(worker_thread, NULL, &ts) == 0)
+     {
+          close(wakefd);
+          wakefd = -1;
+     }
+
+     return;
+}
+
+void notify_get_stats(notify_stats_t *s){
+     pthread_mutex_lock(&lock);
+     *s = stats;
+     pthread_mutex_unlock(&lock);
+
+     return;
+}
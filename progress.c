@@ -0,0 +1,182 @@
+/*
+ *      tty-pomodoro progress bar (--progress).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      A bar under the frame, as wide as the inside of the box, fills up
+ *      as the phase goes by. With a UTF-8 locale its last cell is a left
+ *      1/8 to 7/8 block, so the bar has eight steps a cell. Each tick
+ *      draws it with the digits; in between, barfd has it redrawn as
+ *      often as it gains a step, but no more than PROGRESS_HZ times a
+ *      second. A step changes the cell it ends in, or that one and the
+ *      next: draw_progress() touches only those, and ncurses or ansi.c
+ *      send only those. At PROGRESS_HZ, a cell, a move and at most one
+ *      colour change per update stay under what a digit costs a second.
+ */
+
+#include "ttypomodoro.h"
+#include <langinfo.h>
+#include <locale.h>
+
+static const char *eighth[] =
+{
+     " ", "▏", "▎", "▍", "▌", "▋", "▊", "▉"
+};
+
+/* Cells in the bar of the current terminal */
+static int bar_width(void){
+     return MAX(ttyclock->geo.w - 2, 0);
+}
+
+/* Steps a cell */
+static int bar_steps(void){
+     return ttyclock->option.eighths ? 8 : 1;
+}
+
+/* Bar fill for the countdown as it is now, in eighths of a cell */
+static int bar_fill(int width){
+     const countdown_t *cd = &ttyclock->countdown;
+     int64_t gone = cd->length - MAX(countdown_left(cd), 0);
+     int steps = bar_steps();
+
+     if(cd->length <= 0)
+          return 0;
+     gone = MIN(MAX(gone, 0), cd->length);
+
+     return gone * width * steps / cd->length * (8 / steps);
+}
+
+static void draw_cell(int c, int eighths){
+     if(ttyclock->option.ansi)
+     {
+          ansi_bar(c, eighths);
+          return;
+     }
+
+     if(eighths >= 8)
+     {
+          wattrset(ttyclock->barwin, COLOR_PAIR(1));
+          mvwaddch(ttyclock->barwin, 0, c, ' ');
+     }
+     else
+     {
+          wattrset(ttyclock->barwin, COLOR_PAIR(eighths ? 2 : 0));
+          mvwaddstr(ttyclock->barwin, 0, c, eighth[MAX(eighths, 0)]);
+     }
+
+     return;
+}
+
+/* Bring the current terminal's bar up to date; the caller flushes */
+void draw_progress(void){
+     int width = bar_width(), fill, from, to, c;
+
+     if(!ttyclock->option.progress || (!ttyclock->option.ansi && !ttyclock->barwin))
+          return;
+
+     fill = bar_fill(width);
+     if(fill == ttyclock->frame.bar)
+          return;
+
+     /* The cells between the old end and the new, all of them if unknown */
+     if(ttyclock->frame.bar < 0)
+     {
+          from = 0;
+          to = width - 1;
+     }
+     else
+     {
+          from = MIN(fill, ttyclock->frame.bar) / 8;
+          to = MIN(MAX(fill, ttyclock->frame.bar) / 8, width - 1);
+     }
+     for(c = from; c <= to; ++c)
+          draw_cell(c, fill - c * 8);
+     ttyclock->frame.bar = fill;
+
+     return;
+}
+
+/* Redraw the bars as often as they change, at most PROGRESS_HZ a second */
+void arm_progress(void){
+     const countdown_t *cd = &ttyclock->countdown;
+     struct itimerspec its;
+     int64_t step = 0;
+     int i, width = 0;
+
+     if(!ttyclock->option.progress || ttyclock->barfd <= 0)
+          return;
+
+     memset(&its, 0, sizeof(its));
+     for(i = 0; i < ttyclock->nterm; ++i)
+          width = MAX(width, ttyclock->term[i].geo.w - 2);
+     if(ttyclock->cur)
+          width = MAX(width, bar_width());
+     if(!cd->paused && width > 0 && cd->clock != CLOCK_VIRTUAL && on_screen())
+     {
+          step = MAX(cd->length / (width * bar_steps()), NSEC_PER_SEC / PROGRESS_HZ);
+          its.it_interval.tv_sec = step / NSEC_PER_SEC;
+          its.it_interval.tv_nsec = step % NSEC_PER_SEC;
+          its.it_value = its.it_interval;
+     }
+     timerfd_settime(ttyclock->barfd, 0, &its, NULL);
+
+     return;
+}
+
+/* Update the bar on every terminal between two ticks */
+void progress_frame(void){
+     unsigned long bytes;
+     term_t *t;
+     int i;
+
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          if(t->dead || t->hidden || term_backlog(t) > TERMBACKLOG)
+               continue;
+
+          term_select(t);
+          if(ttyclock->frame.bar == bar_fill(bar_width()))
+               continue;
+          bytes = t->stats.bytes;
+          draw_progress();
+          if(ttyclock->option.ansi)
+               ansi_flush();
+          else
+          {
+               wnoutrefresh(ttyclock->barwin);
+               doupdate();
+          }
+          term_flush(t);
+          ttyclock->stats.progress_bytes += t->stats.bytes - bytes;
+     }
+     ++ttyclock->stats.progress_frames;
+
+     return;
+}
+
+static void progress_event(int fd, short revents, void *arg){
+     uint64_t expirations;
+
+     if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          return;
+     progress_frame();
+
+     return;
+}
+
+/* Before the terminals: ncurses takes the character set from the locale */
+void progress_open(void){
+     setlocale(LC_CTYPE, "");
+     ttyclock->option.eighths = !strcmp(nl_langinfo(CODESET), "UTF-8");
+
+     ttyclock->barfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+     if(ttyclock->barfd < 0)
+     {
+          fprintf(stderr, "tty-pomodoro: error: couldn't set up the progress timer: %s.\n",
+                  strerror(errno));
+          exit(EXIT_FAILURE);
+     }
+     loop_add(ttyclock->barfd, POLLIN, progress_event, NULL);
+
+     return;
+}
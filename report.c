@@ -0,0 +1,564 @@
+/*
+ *      tty-pomodoro reports over the session journal.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      tty-pomodoro report days|weeks|interruptions|streaks|tags
+ *
+ *      A sidecar index (<journal>.idx) holds one 32 byte summary per day
+ *      along with the number of its first journal record. It is brought
+ *      up to date incrementally, from the last record it covers, before
+ *      each report. Day based reports then read only the index entries of
+ *      the requested range; the tags report bisects the index to the
+ *      first day and walks the journal records from there. Every report
+ *      is a single streaming pass holding O(1) state per aggregate, and
+ *      rows are printed as they are completed.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/mman.h>
+
+#define INDEX_MAGIC "TTYPIDX1"
+#define MAXTAGS     64
+#define VALUEMAX    24
+
+typedef struct
+{
+     char magic[8];
+     uint32_t version;
+     /* Journal records summarised so far, and the CRC of the last one */
+     uint32_t covered;
+     uint32_t lastcrc;
+     char pad[12];
+} index_hdr_t;
+
+typedef struct
+{
+     /* Days since 1970-01-01, local time */
+     int32_t day;
+     /* First journal record of the day and how many follow */
+     uint32_t first;
+     uint32_t records;
+     uint32_t started;
+     uint32_t completed;
+     uint32_t interrupted;
+     /* Seconds of work counted down */
+     uint32_t focus;
+     uint32_t breaks;
+} index_day_t;
+
+typedef struct
+{
+     const char *name;
+     Bool text;
+} report_col_t;
+
+/* Output, streamed a row at a time */
+
+static int report_format, report_rows;
+
+enum { FORMAT_TABLE, FORMAT_CSV, FORMAT_JSON };
+
+static void emit_head(const report_col_t *col, int n){
+     int i;
+
+     report_rows = 0;
+     if(report_format == FORMAT_JSON)
+     {
+          putchar('[');
+          return;
+     }
+     for(i = 0; i < n; ++i)
+          if(report_format == FORMAT_CSV)
+               printf("%s%s", i ? "," : "", col[i].name);
+          else
+               printf(i ? "%14s" : "%-12s", col[i].name);
+     putchar('\n');
+
+     return;
+}
+
+static void emit_row(const report_col_t *col, int n, char value[][VALUEMAX]){
+     int i;
+
+     if(report_format == FORMAT_JSON)
+     {
+          printf("%s\n  {", report_rows ? "," : "");
+          for(i = 0; i < n; ++i)
+               printf(col[i].text ? "%s\"%s\": \"%s\"" : "%s\"%s\": %s",
+                      i ? ", " : "", col[i].name, value[i]);
+          putchar('}');
+     }
+     else
+     {
+          for(i = 0; i < n; ++i)
+               if(report_format == FORMAT_CSV)
+                    printf("%s%s", i ? "," : "", value[i]);
+               else
+                    printf(i ? "%14s" : "%-12s", value[i]);
+          putchar('\n');
+     }
+     ++report_rows;
+
+     return;
+}
+
+static void emit_tail(void){
+     if(report_format == FORMAT_JSON)
+          printf("%s]\n", report_rows ? "\n" : "");
+
+     return;
+}
+
+/* Days */
+
+static int32_t day_of(int64_t ns){
+     time_t t = ns / NSEC_PER_SEC;
+     struct tm tm;
+
+     localtime_r(&t, &tm);
+
+     return (t + tm.tm_gmtoff) / 86400 - (t + tm.tm_gmtoff < 0);
+}
+
+static void day_str(int32_t day, char *buf){
+     time_t t = (time_t)day * 86400;
+     struct tm tm;
+
+     gmtime_r(&t, &tm);
+     strftime(buf, VALUEMAX, "%Y-%m-%d", &tm);
+
+     return;
+}
+
+/* YYYY-MM-DD to a day number, -1 if malformed */
+static int32_t parse_day(const char *s){
+     struct tm tm;
+     char *end;
+
+     memset(&tm, 0, sizeof(tm));
+     if(!(end = strptime(s, "%Y-%m-%d", &tm)) || *end)
+          return -1;
+
+     return timegm(&tm) / 86400;
+}
+
+static void index_add(index_day_t *d, const journal_rec_t *r){
+     ++d->records;
+
+     switch(r->type)
+     {
+     case JOURNAL_START:
+          ++d->started;
+          break;
+     case JOURNAL_COMPLETE:
+          if(r->phase == PHASE_WORK)
+               ++d->completed;
+          else
+               ++d->breaks;
+          /* fall through */
+     case JOURNAL_INTERRUPT:
+          if(r->type == JOURNAL_INTERRUPT)
+               ++d->interrupted;
+          if(r->phase == PHASE_WORK)
+               d->focus += r->elapsed;
+          break;
+     }
+
+     return;
+}
+
+/* Summarise the journal records the index doesn't cover yet */
+static int index_update(int fd, const journal_map_t *j){
+     index_hdr_t hdr;
+     index_day_t cur;
+     off_t slot;
+     struct stat st;
+     uint32_t i;
+
+     if(fstat(fd, &st) < 0)
+          return -1;
+
+     if(pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+        || memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic))
+        || hdr.covered > j->n
+        || (hdr.covered && j->rec[hdr.covered - 1].crc != hdr.lastcrc))
+     {
+          /* Missing, damaged or for another journal: start over */
+          memset(&hdr, 0, sizeof(hdr));
+          memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+          hdr.version = 1;
+          st.st_size = sizeof(hdr);
+          if(ftruncate(fd, sizeof(hdr)) < 0)
+               return -1;
+     }
+
+     if(hdr.covered == j->n)
+          return 0;
+
+     /* Carry on with the last day, which may have grown */
+     slot = (st.st_size - sizeof(hdr)) / sizeof(cur);
+     memset(&cur, 0, sizeof(cur));
+     if(slot && pread(fd, &cur, sizeof(cur), sizeof(hdr) + --slot * sizeof(cur)) != sizeof(cur))
+          return -1;
+
+     for(i = hdr.covered; i < j->n; ++i)
+     {
+          const journal_rec_t *r = &j->rec[i];
+          int32_t day;
+
+          if(!journal_valid(r))
+               continue;
+
+          if((day = day_of(r->time)) != cur.day || !cur.records)
+          {
+               if(cur.records && pwrite(fd, &cur, sizeof(cur), sizeof(hdr) + slot++ * sizeof(cur)) < 0)
+                    return -1;
+               memset(&cur, 0, sizeof(cur));
+               cur.day = day;
+               cur.first = i;
+          }
+          index_add(&cur, r);
+     }
+     if(cur.records && pwrite(fd, &cur, sizeof(cur), sizeof(hdr) + slot * sizeof(cur)) < 0)
+          return -1;
+
+     hdr.covered = j->n;
+     hdr.lastcrc = j->rec[j->n - 1].crc;
+     if(pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+          return -1;
+
+     return 0;
+}
+
+/* Index of the first day entry at or after day */
+static size_t index_seek(const index_day_t *d, size_t n, int32_t day){
+     size_t lo = 0, hi = n, mid;
+
+     while(lo < hi)
+     {
+          mid = lo + (hi - lo) / 2;
+          if(d[mid].day < day)
+               lo = mid + 1;
+          else
+               hi = mid;
+     }
+
+     return lo;
+}
+
+/* Reports */
+
+static void report_days(const index_day_t *d, size_t n, int32_t to){
+     static const report_col_t col[] =
+     {
+          { "day", True }, { "sessions", False }, { "breaks", False },
+          { "interrupted", False }, { "focus_minutes", False }
+     };
+     char v[5][VALUEMAX];
+     size_t i;
+
+     emit_head(col, 5);
+     for(i = 0; i < n && d[i].day <= to; ++i)
+     {
+          day_str(d[i].day, v[0]);
+          snprintf(v[1], VALUEMAX, "%u", d[i].completed);
+          snprintf(v[2], VALUEMAX, "%u", d[i].breaks);
+          snprintf(v[3], VALUEMAX, "%u", d[i].interrupted);
+          snprintf(v[4], VALUEMAX, "%u", d[i].focus / 60);
+          emit_row(col, 5, v);
+     }
+     emit_tail();
+
+     return;
+}
+
+static void report_weeks(const index_day_t *d, size_t n, int32_t to){
+     static const report_col_t col[] =
+     {
+          { "week", True }, { "sessions", False }, { "focus_minutes", False }
+     };
+     char v[3][VALUEMAX];
+     uint32_t sessions = 0, focus = 0;
+     int32_t week = 0, w;
+     size_t i;
+
+     emit_head(col, 3);
+     for(i = 0; i <= n; ++i)
+     {
+          /* Weeks start on Monday; day 0 was a Thursday */
+          w = (i < n && d[i].day <= to) ? d[i].day - ((d[i].day + 3) % 7 + 7) % 7 : INT32_MAX;
+          if(w != week && (sessions || focus))
+          {
+               day_str(week, v[0]);
+               snprintf(v[1], VALUEMAX, "%u", sessions);
+               snprintf(v[2], VALUEMAX, "%u", focus / 60);
+               emit_row(col, 3, v);
+               sessions = focus = 0;
+          }
+          if(w == INT32_MAX)
+               break;
+          week = w;
+          sessions += d[i].completed;
+          focus += d[i].focus;
+     }
+     emit_tail();
+
+     return;
+}
+
+static void report_interruptions(const index_day_t *d, size_t n, int32_t to){
+     static const report_col_t col[] =
+     {
+          { "from", True }, { "to", True }, { "started", False },
+          { "interrupted", False }, { "rate", False }
+     };
+     char v[5][VALUEMAX];
+     unsigned long started = 0, interrupted = 0;
+     size_t i;
+
+     for(i = 0; i < n && d[i].day <= to; ++i)
+     {
+          started += d[i].started;
+          interrupted += d[i].interrupted;
+     }
+
+     emit_head(col, 5);
+     if(i)
+     {
+          day_str(d[0].day, v[0]);
+          day_str(d[i - 1].day, v[1]);
+          snprintf(v[2], VALUEMAX, "%lu", started);
+          snprintf(v[3], VALUEMAX, "%lu", interrupted);
+          snprintf(v[4], VALUEMAX, "%.3f", started ? (double)interrupted / started : 0.0);
+          emit_row(col, 5, v);
+     }
+     emit_tail();
+
+     return;
+}
+
+/* Runs of consecutive days with at least one completed work session */
+static void report_streaks(const index_day_t *d, size_t n, int32_t to){
+     static const report_col_t col[] =
+     {
+          { "streak", True }, { "from", True }, { "to", True }, { "days", False }
+     };
+     char v[4][VALUEMAX];
+     int32_t first = 0, last = 0, bfirst = 0, blast = 0;
+     int len = 0, best = 0;
+     size_t i;
+
+     for(i = 0; i < n && d[i].day <= to; ++i)
+     {
+          if(!d[i].completed)
+               continue;
+          if(len && d[i].day == last + 1)
+               ++len;
+          else
+          {
+               first = d[i].day;
+               len = 1;
+          }
+          last = d[i].day;
+          if(len > best)
+          {
+               best = len;
+               bfirst = first;
+               blast = last;
+          }
+     }
+
+     emit_head(col, 4);
+     if(best)
+     {
+          strcpy(v[0], "longest");
+          day_str(bfirst, v[1]);
+          day_str(blast, v[2]);
+          snprintf(v[3], VALUEMAX, "%d", best);
+          emit_row(col, 4, v);
+
+          /* The latest run is current if it reaches today; none, no dates */
+          if(last < day_of(clock_ns(CLOCK_REALTIME)) - 1)
+               len = 0;
+          strcpy(v[0], "current");
+          if(len)
+          {
+               day_str(first, v[1]);
+               day_str(last, v[2]);
+          }
+          else
+          {
+               strcpy(v[1], "-");
+               strcpy(v[2], "-");
+          }
+          snprintf(v[3], VALUEMAX, "%d", len);
+          emit_row(col, 4, v);
+     }
+     emit_tail();
+
+     return;
+}
+
+static void report_tags(const journal_map_t *j, const index_day_t *d, size_t n, int32_t to){
+     static const report_col_t col[] =
+     {
+          { "tag", True }, { "sessions", False }, { "interrupted", False },
+          { "focus_minutes", False }
+     };
+     struct
+     {
+          char tag[sizeof(((journal_rec_t *)0)->tag) + 1];
+          uint32_t sessions, interrupted, focus;
+     } tag[MAXTAGS];
+     char v[4][VALUEMAX];
+     int ntag = 0, t;
+     size_t i, end;
+
+     if(!n)
+     {
+          emit_head(col, 4);
+          emit_tail();
+          return;
+     }
+
+     /* The records of the days in range, straight from the index */
+     for(i = 0; i < n && d[i].day <= to; ++i);
+     end = i ? d[i - 1].first + d[i - 1].records : 0;
+
+     for(i = d[0].first; i < end && i < j->n; ++i)
+     {
+          const journal_rec_t *r = &j->rec[i];
+
+          if(r->phase != PHASE_WORK
+             || (r->type != JOURNAL_COMPLETE && r->type != JOURNAL_INTERRUPT)
+             || !journal_valid(r))
+               continue;
+
+          for(t = 0; t < ntag; ++t)
+               if(!strncmp(tag[t].tag, r->tag, sizeof(r->tag)))
+                    break;
+          if(t == ntag)
+          {
+               /* Past MAXTAGS distinct tags, the rest count as the last one */
+               if(ntag == MAXTAGS)
+                    t = MAXTAGS - 1;
+               else
+               {
+                    memset(&tag[t], 0, sizeof(tag[t]));
+                    memcpy(tag[t].tag, r->tag, sizeof(r->tag));
+                    ++ntag;
+               }
+          }
+
+          if(r->type == JOURNAL_COMPLETE)
+               ++tag[t].sessions;
+          else
+               ++tag[t].interrupted;
+          tag[t].focus += r->elapsed;
+     }
+
+     emit_head(col, 4);
+     for(t = 0; t < ntag; ++t)
+     {
+          snprintf(v[0], VALUEMAX, "%s", *tag[t].tag ? tag[t].tag : "-");
+          snprintf(v[1], VALUEMAX, "%u", tag[t].sessions);
+          snprintf(v[2], VALUEMAX, "%u", tag[t].interrupted);
+          snprintf(v[3], VALUEMAX, "%u", tag[t].focus / 60);
+          emit_row(col, 4, v);
+     }
+     emit_tail();
+
+     return;
+}
+
+int report_run(const char *kind){
+     static const char *kinds[] = { "days", "weeks", "interruptions", "streaks", "tags" };
+     const char *path = journal_path();
+     char ipath[PATH_MAX];
+     journal_map_t j;
+     index_day_t *d = NULL;
+     void *map = MAP_FAILED;
+     size_t n = 0, first;
+     int32_t from = INT32_MIN, to = INT32_MAX;
+     struct stat st;
+     int k, fd;
+
+     for(k = 0; k < 5; ++k)
+          if(kind && !strcmp(kind, kinds[k]))
+               break;
+     if(k == 5)
+     {
+          fprintf(stderr, "tty-pomodoro: error: report days|weeks|interruptions|streaks|tags.\n");
+          return EXIT_FAILURE;
+     }
+
+     if((ttyclock->option.from && (from = parse_day(ttyclock->option.from)) < 0)
+        || (ttyclock->option.to && (to = parse_day(ttyclock->option.to)) < 0))
+     {
+          fprintf(stderr, "tty-pomodoro: error: dates are written YYYY-MM-DD.\n");
+          return EXIT_FAILURE;
+     }
+
+     report_format = FORMAT_TABLE;
+     if(ttyclock->option.report_format)
+     {
+          if(!strcmp(ttyclock->option.report_format, "csv"))
+               report_format = FORMAT_CSV;
+          else if(!strcmp(ttyclock->option.report_format, "json"))
+               report_format = FORMAT_JSON;
+          else if(strcmp(ttyclock->option.report_format, "table"))
+          {
+               fprintf(stderr, "tty-pomodoro: error: --format table|csv|json.\n");
+               return EXIT_FAILURE;
+          }
+     }
+
+     if(journal_map(path, &j) < 0)
+     {
+          /* No journal yet: nothing to report */
+          if(errno != ENOENT)
+          {
+               fprintf(stderr, "tty-pomodoro: error: can't read journal '%s': %s.\n",
+                       path ? path : "", strerror(errno));
+               return EXIT_FAILURE;
+          }
+     }
+     else
+     {
+          snprintf(ipath, sizeof(ipath), "%s.idx", path);
+          if((fd = open(ipath, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0
+             || index_update(fd, &j) < 0 || fstat(fd, &st) < 0)
+          {
+               fprintf(stderr, "tty-pomodoro: error: can't update index '%s': %s.\n",
+                       ipath, strerror(errno));
+               return EXIT_FAILURE;
+          }
+          if(st.st_size > (off_t)sizeof(index_hdr_t)
+             && (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+          {
+               d = (index_day_t *)((char *)map + sizeof(index_hdr_t));
+               n = (st.st_size - sizeof(index_hdr_t)) / sizeof(*d);
+          }
+          close(fd);
+     }
+
+     /* Skip straight to the first day in range */
+     first = d ? index_seek(d, n, from) : 0;
+     d = d ? d + first : NULL;
+     n -= first;
+
+     switch(k)
+     {
+     case 0: report_days(d, n, to); break;
+     case 1: report_weeks(d, n, to); break;
+     case 2: report_interruptions(d, n, to); break;
+     case 3: report_streaks(d, n, to); break;
+     case 4: report_tags(&j, d, n, to); break;
+     }
+
+     if(map != MAP_FAILED)
+          munmap(map, st.st_size);
+     journal_unmap(&j);
+
+     return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*
+ *      tty-pomodoro cycle scheduler (--cycle).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Runs a sequence of phases in one process, over and over:
+ *
+ *        --cycle '4x(work,short),long'
+ *        --cycle 'work:50,short:10'
+ *
+ *      A phase is work, short or long, optionally with its length in
+ *      minutes, or in seconds with an s (short:30s), up to a day; Nx(...)
+ *      repeats a group. ttyclock->cycle is the position in the expanded
+ *      sequence. A phase without a length takes the one in effect when it
+ *      starts (phase_length()), so a change in the config file comes in
+ *      with the next phase of its kind.
+ *
+ *      The next SCHEDULE_AHEAD phases are planned whenever the countdown
+ *      changes (start, pause, resume, a new phase), so the end of a phase
+ *      only swaps in the deadline planned for the next one: with --auto
+ *      that is the old deadline plus the new length, and not a second is
+ *      lost or shown twice. Without --auto the next phase waits, paused at
+ *      its full length, for 'p'.
+ */
+
+#include "ttypomodoro.h"
+
+static struct
+{
+     phase_t phase;
+     int64_t length;
+} seq[SCHEDULE_MAX];
+static int nseq;
+
+static schedule_t plan[SCHEDULE_AHEAD];
+
+static const char *phase_name[] = { "work", "short", "long" };
+static const int phase_minutes[] = { DEFAULT_TIME, SHORT_BREAK, LONG_BREAK };
+
+/* spec := item (',' item)*, item := [N 'x'] ('(' spec ')' | phase[':' N['s']]) */
+static int parse(const char **s){
+     int i, first, count, len;
+     char *end;
+     long n;
+
+     do
+     {
+          count = 1;
+          n = strtol(*s, &end, 10);
+          if(end != *s && *end == 'x')
+          {
+               if(n < 1 || n > SCHEDULE_MAX)
+                    return -1;
+               count = n;
+               *s = end + 1;
+          }
+
+          first = nseq;
+          if(**s == '(')
+          {
+               ++*s;
+               if(parse(s) < 0 || *(*s)++ != ')')
+                    return -1;
+          }
+          else
+          {
+               for(i = 0; i < 3; ++i)
+                    if(!strncmp(*s, phase_name[i], (len = strlen(phase_name[i]))))
+                         break;
+               if(i == 3 || nseq == SCHEDULE_MAX)
+                    return -1;
+               *s += len;
+               seq[nseq].phase = i;
+               seq[nseq].length = 0;
+               if(**s == ':')
+               {
+                    /* Up to a day, as the config file's lengths */
+                    n = strtol(*s + 1, &end, 10);
+                    if(end == *s + 1 || n < 1 || n > (*end == 's' ? 24 * 60 * 60 : 24 * 60))
+                         return -1;
+                    seq[nseq].length = (int64_t)n * (*end == 's' ? 1 : 60) * NSEC_PER_SEC;
+                    *s = end + (*end == 's');
+               }
+               ++nseq;
+          }
+
+          /* Repeat what the item expanded to */
+          for(n = nseq - first; --count; nseq += n)
+          {
+               if(nseq + n > SCHEDULE_MAX)
+                    return -1;
+               memcpy(&seq[nseq], &seq[first], n * sizeof(*seq));
+          }
+     } while(**s == ',' && ++*s);
+
+     return 0;
+}
+
+/* Default length of a phase: the config file's, or the built-in one */
+int64_t phase_length(phase_t phase){
+     if(ttyclock->option.length[phase])
+          return ttyclock->option.length[phase];
+
+     return (int64_t)phase_minutes[phase] * 60 * NSEC_PER_SEC;
+}
+
+/* Length of step k of the sequence */
+static int64_t seq_length(int k){
+     return seq[k].length ? seq[k].length : phase_length(seq[k].phase);
+}
+
+int schedule_parse(const char *spec){
+     const char *s = spec;
+
+     nseq = 0;
+     if(parse(&s) < 0 || *s || !nseq)
+     {
+          nseq = 0;
+          return -1;
+     }
+
+     return 0;
+}
+
+Bool schedule_active(void){
+     return nseq > 0;
+}
+
+/* Enter the phase at ttyclock->cycle; its length */
+int64_t schedule_begin(void){
+     ttyclock->cycle %= nseq;
+     ttyclock->phase = seq[ttyclock->cycle].phase;
+
+     return seq_length(ttyclock->cycle);
+}
+
+/* Plan the next phases from the countdown as it is now */
+void schedule_plan(void){
+     const countdown_t *cd = &ttyclock->countdown;
+     int64_t end;
+     int i, k;
+
+     if(!nseq)
+          return;
+
+     end = cd->paused ? clock_ns(cd->clock) + cd->left : cd->deadline;
+     for(i = 0; i < SCHEDULE_AHEAD; ++i)
+     {
+          k = (ttyclock->cycle + i) % nseq;
+          plan[i].phase = seq[k].phase;
+          plan[i].length = i ? seq_length(k) : cd->length;
+          plan[i].end = i ? end + plan[i].length : end;
+          plan[i].start = plan[i].end - plan[i].length;
+          /* Times hold unless a pause or a wait for 'p' comes first */
+          plan[i].firm = !cd->paused && (!i || ttyclock->option.autoadvance);
+          end = plan[i].end;
+     }
+
+     return;
+}
+
+/* The planned phases, the running one first. Times are on the countdown
+ * clock; a paused plan is redone since its times slide with the clock. */
+const schedule_t *schedule_get(int *n){
+     if(nseq && ttyclock->countdown.paused)
+          schedule_plan();
+     *n = nseq ? SCHEDULE_AHEAD : 0;
+
+     return plan;
+}
+
+/* The running phase is over: swap in the next one */
+void schedule_advance(void){
+     countdown_t *cd = &ttyclock->countdown;
+
+     journal_append(JOURNAL_COMPLETE);
+     notify_phase_end(ttyclock->phase, seq[(ttyclock->cycle + 1) % nseq].phase, False);
+
+     ++ttyclock->cycle;
+     cd->length = schedule_begin();
+     if(ttyclock->option.autoadvance)
+     {
+          cd->deadline = plan[1].end;
+          journal_append(JOURNAL_START);
+     }
+     else
+     {
+          cd->left = cd->length;
+          cd->paused = True;
+     }
+     checkpoint_save();
+     schedule_plan();
+     arm_timer();
+
+     return;
+}
+
+/* Wall clock time of t on the countdown clock */
+static time_t wall(int64_t t){
+     return (clock_ns(CLOCK_REALTIME) + t - clock_ns(ttyclock->countdown.clock)) / NSEC_PER_SEC;
+}
+
+/* --schedule: the plan as a table, ~ marking estimated times */
+void schedule_print(void){
+     const schedule_t *p;
+     char from[16], to[16];
+     time_t t;
+     int i, n;
+
+     p = schedule_get(&n);
+     for(i = 0; i < n; ++i, ++p)
+     {
+          t = wall(p->start);
+          strftime(from, sizeof(from), "%H:%M:%S", localtime(&t));
+          t = wall(p->end);
+          strftime(to, sizeof(to), "%H:%M:%S", localtime(&t));
+          printf("%2d  %-5s  %3d:%02d  %c%s - %s\n", i, phase_name[p->phase],
+                 (int)(p->length / NSEC_PER_SEC / 60), (int)(p->length / NSEC_PER_SEC % 60),
+                 p->firm ? ' ' : '~', from, to);
+     }
+
+     return;
+}
+
+const char *schedule_phase_name(phase_t phase){
+     return phase_name[phase];
+}
@@ -0,0 +1,526 @@
+/*
+ *      tty-pomodoro attach server and viewers (tty-pomodoro attach).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      The first "attach" finds nobody on share_path() and forks the
+ *      timer off into a process of its own, detached from the terminal:
+ *      the usual countdown, --cycle, journal and checkpoint with no
+ *      display. That one and every later "attach" are viewers: they draw
+ *      the timer with their own terminals and options, and closing one
+ *      (q, or its pane) leaves the timer running for the others.
+ *
+ *      A viewer is sent a snapshot of the timer, then one line per
+ *      change:
+ *
+ *          state <clock> <phase> <cycle> <paused> <deadline> <left> <length>
+ *          phase <phase> <cycle> <paused> <deadline> <left> <length>
+ *          pause <left>
+ *          resume <deadline>
+ *          end
+ *
+ *      in nanoseconds on <clock>, as the daemon's timer lines. A viewer
+ *      ticks from the deadline on its own clock, so nothing is sent
+ *      between changes. A change is formatted once, when arm_timer()
+ *      publishes it, and the same line goes to every viewer. A viewer
+ *      that can't take it yet keeps up to SHAREBUF bytes waiting; past
+ *      that it is sent nothing more until it has read them, and then a
+ *      fresh snapshot instead of what it missed. Viewers send "pause",
+ *      which pauses or resumes.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define SHARELINE 128
+#define SHAREBUF  1024
+/* How long a viewer waits for its snapshot, in seconds */
+#define SHAREWAIT 5
+
+typedef struct viewer viewer_t;
+
+struct viewer
+{
+     int fd;
+     char in[SHARELINE];
+     size_t inlen;
+     char out[SHAREBUF];
+     size_t outlen;
+     /* Missed a change: gets a snapshot once out is drained */
+     Bool stale;
+     viewer_t *next;
+};
+
+/* What the viewers were last told */
+typedef struct
+{
+     phase_t phase;
+     unsigned int cycle;
+     Bool paused;
+     int64_t deadline, left, length;
+} share_state_t;
+
+static const char *clock_name[] = { "boottime", "monotonic" };
+
+/* Server side */
+static Bool serving;
+static viewer_t *viewers;
+/* Closed viewers, freed once no callback can use them */
+static viewer_t *zombie;
+static share_state_t last;
+
+/* Viewer side */
+static int server = -1;
+static char buf[SHARELINE];
+static size_t len;
+
+const char *share_path(void){
+     static char path[108];
+     const char *dir = getenv("XDG_RUNTIME_DIR");
+
+     if(ttyclock->option.socket)
+          return ttyclock->option.socket;
+
+     if(dir && *dir)
+          snprintf(path, sizeof(path), "%s/tty-pomodoro-attach.sock", dir);
+     else
+          snprintf(path, sizeof(path), "/tmp/tty-pomodoro-attach-%u.sock", (unsigned)getuid());
+
+     return path;
+}
+
+Bool share_serving(void){
+     return serving;
+}
+
+Bool share_viewing(void){
+     return server >= 0;
+}
+
+static void current(share_state_t *s){
+     const countdown_t *cd = &ttyclock->countdown;
+
+     s->phase = ttyclock->phase;
+     s->cycle = ttyclock->cycle;
+     s->paused = cd->paused;
+     s->deadline = cd->deadline;
+     s->left = MAX(countdown_left(cd), 0);
+     s->length = cd->length;
+
+     return;
+}
+
+static int snapshot(char *line, size_t size){
+     share_state_t s;
+
+     current(&s);
+
+     return snprintf(line, size, "state %s %d %u %d %lld %lld %lld\n",
+                     clock_name[ttyclock->countdown.clock == CLOCK_MONOTONIC],
+                     s.phase, s.cycle, s.paused, (long long)s.deadline,
+                     (long long)s.left, (long long)s.length);
+}
+
+/* Server side */
+
+static void viewer_close(viewer_t *v){
+     viewer_t **p;
+
+     if(v->fd < 0)
+          return;
+
+     for(p = &viewers; *p; p = &(*p)->next)
+          if(*p == v)
+          {
+               *p = v->next;
+               break;
+          }
+     loop_del(v->fd);
+     close(v->fd);
+     v->fd = -1;
+     v->next = zombie;
+     zombie = v;
+     --ttyclock->stats.share_viewers;
+
+     return;
+}
+
+static void viewer_reap(void){
+     viewer_t *v;
+
+     while((v = zombie))
+     {
+          zombie = v->next;
+          free(v);
+     }
+
+     return;
+}
+
+/* Send what is waiting, and a snapshot after it if v missed a change */
+static void viewer_flush(viewer_t *v){
+     ssize_t n;
+
+     for(;;)
+     {
+          if(!v->outlen && v->stale)
+          {
+               v->outlen = snapshot(v->out, sizeof(v->out));
+               v->stale = False;
+          }
+          if(!v->outlen)
+               break;
+          if((n = send(v->fd, v->out, v->outlen, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0)
+          {
+               if(errno == EINTR)
+                    continue;
+               if(errno != EAGAIN)
+               {
+                    viewer_close(v);
+                    return;
+               }
+               break;
+          }
+          ttyclock->stats.share_bytes += n;
+          memmove(v->out, v->out + n, v->outlen - n);
+          v->outlen -= n;
+     }
+     loop_set_events(v->fd, POLLIN | (v->outlen ? POLLOUT : 0));
+
+     return;
+}
+
+/* Pass line on to v, straight to its socket when nothing is waiting */
+static void viewer_send(viewer_t *v, const char *line, size_t n){
+     ssize_t sent = 0;
+
+     if(v->stale)
+          return;
+     if(!v->outlen && (sent = send(v->fd, line, n, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0)
+     {
+          if(errno != EAGAIN && errno != EINTR)
+          {
+               viewer_close(v);
+               return;
+          }
+          sent = 0;
+     }
+     ttyclock->stats.share_bytes += sent;
+     if((size_t)sent == n)
+          return;
+
+     if(v->outlen + n - sent > sizeof(v->out))
+     {
+          v->stale = True;
+          ++ttyclock->stats.share_resyncs;
+     }
+     else
+     {
+          memcpy(v->out + v->outlen, line + sent, n - sent);
+          v->outlen += n - sent;
+     }
+     loop_set_events(v->fd, POLLIN | POLLOUT);
+
+     return;
+}
+
+/* One line to every viewer */
+static void broadcast(const char *line, size_t n){
+     viewer_t *v, *next;
+
+     for(v = viewers; v; v = next)
+     {
+          next = v->next;
+          viewer_send(v, line, n);
+     }
+     ++ttyclock->stats.share_events;
+
+     return;
+}
+
+static void viewer_event(int fd, short revents, void *arg){
+     viewer_t *v = arg;
+     char *nl;
+     ssize_t n;
+
+     viewer_reap();
+     if(revents & POLLOUT)
+     {
+          viewer_flush(v);
+          if(v->fd < 0)
+               return;
+     }
+     if(!(revents & (POLLIN | POLLHUP | POLLERR)))
+          return;
+
+     n = read(fd, v->in + v->inlen, sizeof(v->in) - v->inlen);
+     if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+     {
+          viewer_close(v);
+          return;
+     }
+     if(n < 0)
+          return;
+     v->inlen += n;
+
+     while((nl = memchr(v->in, '\n', v->inlen)))
+     {
+          *nl = '\0';
+          if(!strcmp(v->in, "pause"))
+               toggle_pause();
+          /* Closed by the change going out */
+          if(v->fd < 0)
+               return;
+          v->inlen -= nl + 1 - v->in;
+          memmove(v->in, nl + 1, v->inlen);
+     }
+
+     /* No command is that long */
+     if(v->inlen == sizeof(v->in))
+          viewer_close(v);
+
+     return;
+}
+
+static void accept_event(int fd, short revents, void *arg){
+     char line[SHARELINE];
+     viewer_t *v;
+     int vfd;
+
+     viewer_reap();
+     while((vfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+     {
+          if(!(v = calloc(1, sizeof(*v))))
+          {
+               close(vfd);
+               continue;
+          }
+          v->fd = vfd;
+          v->next = viewers;
+          viewers = v;
+          ++ttyclock->stats.share_viewers;
+          loop_add(vfd, POLLIN, viewer_event, v);
+          viewer_send(v, line, snapshot(line, sizeof(line)));
+     }
+
+     return;
+}
+
+/* Tell the viewers how the countdown changed, if it did */
+void share_publish(void){
+     char line[SHARELINE];
+     share_state_t s;
+     int n;
+
+     if(!serving)
+          return;
+
+     current(&s);
+     if(s.phase != last.phase || s.cycle != last.cycle || s.length != last.length
+        || (s.paused == last.paused && (s.paused ? s.left != last.left : s.deadline != last.deadline)))
+          n = snprintf(line, sizeof(line), "phase %d %u %d %lld %lld %lld\n",
+                       s.phase, s.cycle, s.paused, (long long)s.deadline,
+                       (long long)s.left, (long long)s.length);
+     else if(s.paused != last.paused)
+          n = s.paused ? snprintf(line, sizeof(line), "pause %lld\n", (long long)s.left)
+               : snprintf(line, sizeof(line), "resume %lld\n", (long long)s.deadline);
+     else
+          return;
+     last = s;
+
+     if(viewers)
+          broadcast(line, n);
+
+     return;
+}
+
+/* The timer is over; the process ends right after */
+void share_end(void){
+     if(serving && viewers)
+          broadcast("end\n", 4);
+
+     return;
+}
+
+/* At exit: the next attach starts a timer of its own */
+void share_close(void){
+     if(serving)
+          unlink(share_path());
+
+     return;
+}
+
+/* Leave the terminal: the timer lives on in this process, on lfd */
+static void serve(int lfd){
+     int fd;
+
+     setsid();
+     if((fd = open("/dev/null", O_RDWR)) >= 0)
+     {
+          dup2(fd, STDIN_FILENO);
+          dup2(fd, STDOUT_FILENO);
+          dup2(fd, STDERR_FILENO);
+          if(fd > STDERR_FILENO)
+               close(fd);
+     }
+     /* A viewer gone away is an EPIPE, not the end of the timer */
+     signal(SIGPIPE, SIG_IGN);
+
+     serving = True;
+     ttyclock->option.stream = NULL;
+     current(&last);
+     loop_add(lfd, POLLIN, accept_event, NULL);
+
+     return;
+}
+
+/* Viewer side */
+
+/* Mirror a line from the server into ttyclock->countdown */
+static void apply(const char *line){
+     countdown_t *cd = &ttyclock->countdown;
+     phase_t phase = ttyclock->phase;
+     unsigned int cycle = ttyclock->cycle;
+     char clock[16];
+     long long deadline, left, length;
+     int p, paused;
+
+     if(sscanf(line, "state %15s %d %u %d %lld %lld %lld",
+               clock, &p, &ttyclock->cycle, &paused, &deadline, &left, &length) == 7)
+          cd->clock = strcmp(clock, "monotonic") ? CLOCK_BOOTTIME : CLOCK_MONOTONIC;
+     else if(sscanf(line, "phase %d %u %d %lld %lld %lld",
+                    &p, &ttyclock->cycle, &paused, &deadline, &left, &length) == 6)
+     {
+          /* Rung here, where the terminals are; the hooks run in the server */
+          if(cycle != ttyclock->cycle)
+               notify_phase_end(phase, p, False);
+     }
+     else if(sscanf(line, "pause %lld", &left) == 1)
+     {
+          cd->left = left;
+          cd->paused = True;
+          return;
+     }
+     else if(sscanf(line, "resume %lld", &deadline) == 1)
+     {
+          cd->deadline = deadline;
+          cd->paused = False;
+          return;
+     }
+     else
+     {
+          if(!strcmp(line, "end"))
+          {
+               notify_phase_end(phase, phase, True);
+               ttyclock->remaining.expired = True;
+               ttyclock->running = False;
+          }
+          return;
+     }
+
+     ttyclock->phase = p;
+     cd->paused = paused;
+     cd->deadline = deadline;
+     cd->left = left;
+     cd->length = length;
+
+     return;
+}
+
+static void server_event(int fd, short revents, void *arg){
+     char *nl;
+     ssize_t n;
+
+     n = read(fd, buf + len, sizeof(buf) - len);
+     if(n <= 0)
+     {
+          if(n < 0 && (errno == EAGAIN || errno == EINTR))
+               return;
+          /* The timer is gone; it says "end" first if it ran out */
+          ttyclock->running = False;
+          loop_del(fd);
+          return;
+     }
+     len += n;
+
+     while((nl = memchr(buf, '\n', len)))
+     {
+          *nl = '\0';
+          apply(buf);
+          len -= nl + 1 - buf;
+          memmove(buf, nl + 1, len);
+     }
+     if(len == sizeof(buf))
+          len = 0;
+
+     if(ttyclock->running)
+     {
+          arm_timer();
+          update_hour();
+          draw_terms();
+     }
+
+     return;
+}
+
+/* Connect to the timer on share_path(), starting it if there is none.
+ * Returns in the viewer with the countdown mirrored, or, having forked,
+ * in the timer's own process (share_serving()). */
+int share_attach(void){
+     struct timeval wait = { SHAREWAIT, 0 };
+     char line[SHARELINE];
+     size_t n = 0;
+     pid_t pid;
+     int lfd;
+
+     if((server = socket_connect(share_path())) < 0)
+     {
+          /* Listening before the fork: the viewer can connect at once */
+          if((lfd = socket_listen(share_path())) < 0)
+               return -1;
+          if((pid = fork()) < 0)
+          {
+               close(lfd);
+               return -1;
+          }
+          if(!pid)
+          {
+               /* Twice, so that the timer is nobody's child to reap */
+               if((pid = fork()) != 0)
+                    _exit(pid < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+               serve(lfd);
+               return 0;
+          }
+          close(lfd);
+          waitpid(pid, NULL, 0);
+          if((server = socket_connect(share_path())) < 0)
+               return -1;
+     }
+
+     /* The snapshot, waited for */
+     setsockopt(server, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+     while(n + 1 < sizeof(line) && read(server, line + n, 1) == 1 && line[n] != '\n')
+          ++n;
+     line[n] = '\0';
+     if(strncmp(line, "state ", 6))
+     {
+          close(server);
+          server = -1;
+          errno = ENOENT;
+          return -1;
+     }
+     apply(line);
+
+     fcntl(server, F_SETFL, O_NONBLOCK);
+     loop_add(server, POLLIN, server_event, NULL);
+
+     return 0;
+}
+
+/* 'p' in a viewer: the server pauses or resumes, and says so */
+void share_pause(void){
+     if(send(server, "pause\n", 6, MSG_NOSIGNAL) != 6)
+          ttyclock->running = False;
+
+     return;
+}
@@ -0,0 +1,157 @@
+/*
+ *      tty-pomodoro simulation (--clock virtual).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      On the virtual clock the countdown only moves when a script says
+ *      so, and as fast as the frames can be drawn: nothing sleeps. Every
+ *      tick on the way, that is every change of the displayed seconds,
+ *      goes through the real update_hour()/draw_terms() path, phase ends
+ *      and --cycle advances included, so a day of cycles plays out in
+ *      moments on a terminal or as --stream lines. One command per line:
+ *
+ *        wait s     let s seconds go by (s may have a fraction: 0.25), up
+ *                   to a year
+ *        pause      'p': pause, or resume
+ *        quit       stop; the end of the script does too
+ *
+ *      with # starting a comment. The script is read whole before the
+ *      run, so a bad line is reported before any terminal is touched.
+ */
+
+#include "ttypomodoro.h"
+
+/* Longest wait, in seconds: a year */
+#define SIM_WAIT_MAX (365 * 24 * 60 * 60)
+
+enum { SIM_WAIT, SIM_PAUSE, SIM_QUIT };
+
+typedef struct
+{
+     int op;
+     int64_t ns;
+} sim_step_t;
+
+static sim_step_t *step;
+static int nstep;
+
+/* Read the script at path, "-" for stdin */
+int sim_load(const char *path){
+     char line[256], *s, *end;
+     sim_step_t st;
+     double secs;
+     void *grown;
+     FILE *f;
+     int n = 0, ret = 0;
+
+     if(!(f = strcmp(path, "-") ? fopen(path, "r") : stdin))
+     {
+          fprintf(stderr, "tty-pomodoro: error: couldn't open '%s': %s.\n", path, strerror(errno));
+          return -1;
+     }
+
+     while(fgets(line, sizeof(line), f))
+     {
+          ++n;
+          if((s = strchr(line, '#')))
+               *s = '\0';
+          for(s = line; *s == ' ' || *s == '\t'; ++s);
+          if(!*s || *s == '\n')
+               continue;
+
+          st.ns = 0;
+          if(!strncmp(s, "wait", 4))
+          {
+               st.op = SIM_WAIT;
+               secs = strtod(s + 4, &end);
+               /* Also false for nan */
+               if(end == s + 4 || !(secs >= 0 && secs <= SIM_WAIT_MAX))
+                    s = NULL;
+               else
+               {
+                    st.ns = secs * NSEC_PER_SEC;
+                    s = end;
+               }
+          }
+          else if(!strncmp(s, "pause", 5))
+          {
+               st.op = SIM_PAUSE;
+               s += 5;
+          }
+          else if(!strncmp(s, "quit", 4))
+          {
+               st.op = SIM_QUIT;
+               s += 4;
+          }
+          else
+               s = NULL;
+          /* Nothing but blanks after the command */
+          for(; s && (*s == ' ' || *s == '\t' || *s == '\n'); ++s);
+          if(!s || *s)
+          {
+               fprintf(stderr, "tty-pomodoro: error: %s:%d: bad script line.\n", path, n);
+               ret = -1;
+               break;
+          }
+
+          if(!(grown = realloc(step, (nstep + 1) * sizeof(*step))))
+          {
+               ret = -1;
+               break;
+          }
+          step = grown;
+          step[nstep++] = st;
+     }
+     if(f != stdin)
+          fclose(f);
+
+     return ret;
+}
+
+/* Draw the next tick if it comes by until, and say so; otherwise let the
+ * virtual clock get to until */
+Bool sim_tick(int64_t until){
+     int64_t next = tick_next();
+
+     if(!ttyclock->running || !next || next > until)
+     {
+          clock_set_virtual(until);
+          return False;
+     }
+
+     clock_set_virtual(next);
+     update_hour();
+     draw_terms();
+     /* Keys, signals and readers in between, without waiting for them */
+     loop_once(0);
+
+     return True;
+}
+
+/* Play the script, then stop */
+void sim_run(void){
+     int64_t now = clock_ns(CLOCK_VIRTUAL);
+     int i;
+
+     for(i = 0; i < nstep && ttyclock->running; ++i)
+          switch(step[i].op)
+          {
+          case SIM_WAIT:
+               now += step[i].ns;
+               while(sim_tick(now));
+               break;
+          case SIM_PAUSE:
+               toggle_pause();
+               draw_terms();
+               break;
+          case SIM_QUIT:
+               ttyclock->running = False;
+               break;
+          }
+     ttyclock->running = False;
+
+     free(step);
+     step = NULL;
+     nstep = 0;
+
+     return;
+}
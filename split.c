@@ -0,0 +1,395 @@
+/*
+ *      tty-pomodoro split screen (--split).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Tiles the terminal with timers: the usual one, whose phases, pauses
+ *      and journal go on as without --split, and the others of
+ *
+ *        --split 'standup=15@4,tea=3m,break=short'
+ *
+ *      each a label, a length (minutes, Ns seconds, or work, short or long)
+ *      and optionally a colour, counting down from the start. Every timer
+ *      has its own deadline, and shares the two colour pairs of its colour
+ *      with the others, so 16 pairs do for any number of timers.
+ *      split_layout() picks the grid that gives the digits the largest
+ *      scale, with the fewest empty tiles, or a line a timer when not even
+ *      scale 1 fits; it only runs at the start and on a resize.
+ *      split_frame() is the render pass: it repaints the slots that
+ *      changed in the timers that changed, stages their windows and sends
+ *      them all with one doupdate(). The other timers tick through
+ *      splitfd, armed for the earliest of their next changes; the usual
+ *      one through the tick timer.
+ *
+ *      The tiles have no frame to move, centre or box, and draw on one
+ *      ncurses terminal.
+ */
+
+#include "ttypomodoro.h"
+
+#define SPLITMAX   32
+#define SPLITLABEL 16
+/* First colour pair of the tiles, two a colour, shared by the timers of
+ * that colour: the digits and the label */
+#define SPLITPAIR  3
+
+typedef struct
+{
+     char label[SPLITLABEL];
+     int64_t length;
+     int color;
+     /* Unused for timer 0, which is ttyclock->countdown */
+     countdown_t countdown;
+     WINDOW *win;
+     /* What the tile shows, -1 for unknown */
+     int digit[4], colon, paused, phase;
+     /* The bell rung at the end */
+     Bool rung;
+} split_t;
+
+static split_t timer[SPLITMAX];
+static int ntimer, splitfd = -1;
+
+/* The grid, the digit scale (0 for a line a timer), and what the tiles
+ * were drawn with */
+static struct
+{
+     int cols, rows, cw, ch, scale;
+     int bold, font;
+} layout;
+
+Bool split_active(void){
+     return ntimer > 0;
+}
+
+static countdown_t *countdown(int i){
+     return i ? &timer[i].countdown : &ttyclock->countdown;
+}
+
+/* spec := item (',' item)*, item := label '=' length ['@' colour] */
+int split_parse(const char *spec){
+     const char *s = spec, *eq, *name;
+     split_t *t;
+     char *end;
+     long n;
+     int i;
+
+     ntimer = 1;
+     while(*s)
+     {
+          if(ntimer == SPLITMAX || !(eq = strchr(s, '=')) || eq == s || eq - s >= SPLITLABEL)
+               return -1;
+          t = &timer[ntimer++];
+          memset(t, 0, sizeof(*t));
+          memcpy(t->label, s, eq - s);
+          s = eq + 1;
+
+          for(i = 0; i < 3; ++i)
+          {
+               name = schedule_phase_name(i);
+               if(!strncmp(s, name, strlen(name)))
+                    break;
+          }
+          if(i < 3)
+          {
+               t->length = phase_length(i);
+               s += strlen(name);
+          }
+          else
+          {
+               /* Up to a day, as the config file's lengths */
+               n = strtol(s, &end, 10);
+               if(end == s || n < 1 || n > (*end == 's' ? 24 * 60 * 60 : 24 * 60))
+                    return -1;
+               t->length = (int64_t)n * (*end == 's' ? 1 : 60) * NSEC_PER_SEC;
+               s = end + (*end == 's' || *end == 'm');
+          }
+
+          t->color = (ttyclock->option.color + ntimer - 1) % 7 + 1;
+          if(*s == '@')
+          {
+               if((n = strtol(s + 1, &end, 10)) < 0 || n > 7 || end == s + 1)
+                    return -1;
+               t->color = n;
+               s = end;
+          }
+          if(*s && *s++ != ',')
+               return -1;
+     }
+
+     return 0;
+}
+
+/* Forget what timer i's tile shows */
+static void invalidate(int i){
+     memset(timer[i].digit, -1, sizeof(timer[i].digit));
+     timer[i].colon = timer[i].paused = timer[i].phase = -1;
+
+     return;
+}
+
+/* The digits' colour pair of timer i, the label's next to it */
+static int pair(int i){
+     return SPLITPAIR + 2 * timer[i].color;
+}
+
+/* Tile the current terminal; the next split_frame() repaints every tile */
+void split_layout(void){
+     int lines = ttyclock->cur->lines, cols = ttyclock->cur->cols;
+     int max = ttyclock->option.scale ? ttyclock->option.scale : MAXSCALE;
+     int c, r, s, i, w, h;
+
+     /* Largest scale, then fewest empty tiles */
+     layout.scale = -1;
+     for(c = 1; c <= ntimer; ++c)
+     {
+          r = (ntimer + c - 1) / c;
+          for(s = max; s > 0 && (FRAMEW(NORMFRAMEW, s) > cols / c || FRAMEH(s) > lines / r); --s);
+          if(s > layout.scale || (s == layout.scale && c * r < layout.cols * layout.rows))
+          {
+               layout.scale = s;
+               layout.cols = c;
+               layout.rows = r;
+          }
+     }
+     /* Not even scale 1: a line a timer, in as few columns as fit */
+     if(!layout.scale)
+     {
+          layout.cols = (ntimer + MAX(lines, 1) - 1) / MAX(lines, 1);
+          layout.rows = (ntimer + layout.cols - 1) / layout.cols;
+     }
+     layout.cw = MAX(cols / layout.cols, 1);
+     layout.ch = layout.scale ? MAX(lines / layout.rows, 1) : 1;
+     /* Lines keep a blank between columns */
+     w = layout.scale ? FRAMEW(NORMFRAMEW, layout.scale) : MAX(layout.cw - (layout.cols > 1), 1);
+     h = layout.scale ? FRAMEH(layout.scale) : 1;
+
+     for(i = 0; i < ntimer; ++i)
+     {
+          if(timer[i].win)
+               delwin(timer[i].win);
+          /* Centred in its tile */
+          timer[i].win = newwin(h, w, i / layout.cols * layout.ch + (layout.ch - h) / 2,
+                                i % layout.cols * layout.cw + (layout.cw - w) / 2);
+          invalidate(i);
+     }
+
+     /* Nothing but the tiles */
+     wbkgdset(stdscr, COLOR_PAIR(0));
+     werase(stdscr);
+     wnoutrefresh(stdscr);
+     clearok(curscr, True);
+     ++ttyclock->stats.split_layouts;
+
+     return;
+}
+
+/* Timer i's label, centred on its tile's top row */
+static void draw_label(int i, const int *digit){
+     split_t *t = &timer[i];
+     const char *label = i ? t->label : schedule_phase_name(ttyclock->phase);
+     const char *state = (i ? t->rung : countdown(i)->paused) ? (i ? " done" : " paused") : "";
+     char line[SPLITLABEL + 16];
+     int w = getmaxx(t->win), n;
+
+     /* Blanks blank, whatever the digits left */
+     wbkgdset(t->win, COLOR_PAIR(0));
+     wattrset(t->win, COLOR_PAIR(pair(i) + 1));
+     if(!layout.scale)
+     {
+          /* The whole tile: label, time left */
+          snprintf(line, sizeof(line), "%s%s", label, state);
+          mvwprintw(t->win, 0, 0, "%-*.*s %d%d:%d%d", MAX(w - 6, 0), MAX(w - 6, 0), line,
+                    digit[0], digit[1], digit[2], digit[3]);
+          return;
+     }
+     n = snprintf(line, sizeof(line), " %s%s ", label, state);
+     wmove(t->win, 0, 0);
+     wclrtoeol(t->win);
+     mvwaddnstr(t->win, 0, MAX((w - n) / 2, 0), line, w);
+
+     return;
+}
+
+/* Bring timer i's tile up to date; whether it changed */
+static Bool draw_tile(int i){
+     static const int slot_y[4] = { 1, 8, 20, 27 };
+     split_t *t = &timer[i];
+     const countdown_t *cd = countdown(i);
+     WINDOW *framewin = ttyclock->framewin;
+     int scale = ttyclock->geo.scale, s = layout.scale;
+     int digit[4], colon, k, p = pair(i);
+     Bool changed;
+     remaining_t r;
+
+     if(i)
+          countdown_remaining(cd, &r);
+     else
+          r = ttyclock->remaining;
+     clock_digits(&r, digit);
+     colon = (ttyclock->option.blink && r.seconds % 2 == 0) ? p + 1 : p;
+
+     /* An other timer ends: once the bell, then 00:00 */
+     if(i && r.expired && !t->rung)
+     {
+          t->rung = True;
+          t->paused = -1;
+          beep();
+     }
+
+     changed = memcmp(digit, t->digit, sizeof(digit)) || colon != t->colon;
+     if(!changed && t->paused == cd->paused && t->phase == (int)ttyclock->phase)
+          return False;
+
+     if(t->paused != cd->paused || t->phase != (int)ttyclock->phase || !s)
+          draw_label(i, digit);
+     t->paused = cd->paused;
+     t->phase = ttyclock->phase;
+
+     if(s)
+     {
+          /* draw_glyph() draws on the frame at the frame's scale */
+          ttyclock->framewin = t->win;
+          ttyclock->geo.scale = s;
+          for(k = 0; k < 4; ++k)
+               if(digit[k] != t->digit[k])
+                    draw_glyph('0' + digit[k], 1, 1 + (slot_y[k] - 1) * s, p, True);
+          if(colon != t->colon)
+               draw_colon(1 + 15 * s, colon);
+          ttyclock->framewin = framewin;
+          ttyclock->geo.scale = scale;
+     }
+     memcpy(t->digit, digit, sizeof(digit));
+     t->colon = colon;
+
+     wnoutrefresh(t->win);
+     ++ttyclock->stats.split_tiles;
+
+     return True;
+}
+
+/* The render pass: every tile that changed, then one doupdate() */
+void split_frame(void){
+     term_t *t = &ttyclock->term[0];
+     int i, n = 0;
+
+     if(t->dead || t->hidden)
+          return;
+     term_select(t);
+
+     /* What every tile is drawn with, and timer 0's colour */
+     if(layout.bold != ttyclock->option.bold || layout.font != ttyclock->option.font)
+     {
+          layout.bold = ttyclock->option.bold;
+          layout.font = ttyclock->option.font;
+          for(i = 0; i < ntimer; ++i)
+               invalidate(i);
+     }
+     if(timer[0].color != ttyclock->option.color)
+     {
+          timer[0].color = ttyclock->option.color;
+          invalidate(0);
+     }
+
+     for(i = 0; i < ntimer; ++i)
+          n += draw_tile(i);
+     if(n)
+          doupdate();
+     ++t->stats.frames;
+
+     return;
+}
+
+/* The next change of the other timers, on splitfd */
+void arm_split(void){
+     struct itimerspec its;
+     int64_t next, first = 0;
+     int i;
+
+     if(splitfd < 0)
+          return;
+
+     memset(&its, 0, sizeof(its));
+     for(i = 1; i < ntimer; ++i)
+          if(!timer[i].rung && (next = countdown_next_tick(&timer[i].countdown, tick_unit())))
+               first = first ? MIN(first, next) : next;
+     its.it_value.tv_sec = first / NSEC_PER_SEC;
+     its.it_value.tv_nsec = first % NSEC_PER_SEC;
+     timerfd_settime(splitfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+     return;
+}
+
+static void split_event(int fd, short revents, void *arg){
+     uint64_t expirations;
+
+     if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          return;
+     draw_terms();
+     arm_split();
+
+     return;
+}
+
+/* Keys the tiles have no use for: moving, centring, boxing the frame */
+Bool split_ignores(int c){
+     return c == KEY_UP || c == KEY_DOWN || c == KEY_LEFT || c == KEY_RIGHT
+          || (c < 128 && strchr("hjklHJKLcCxXsStTrR", c));
+}
+
+/* Start the other timers and tile the current terminal, once it is set up */
+void split_open(void){
+     int i;
+
+     if(SPLITPAIR + 2 * 8 > COLOR_PAIRS)
+     {
+          fprintf(stderr, "tty-pomodoro: error: --split needs %d colour pairs, the terminal has %d.\n",
+                  SPLITPAIR + 2 * 8, COLOR_PAIRS);
+          exit(EXIT_FAILURE);
+     }
+     timer[0].color = ttyclock->option.color;
+     for(i = 0; i < 8; ++i)
+     {
+          init_pair(SPLITPAIR + 2 * i, ttyclock->bg, i);
+          init_pair(SPLITPAIR + 2 * i + 1, i, ttyclock->bg);
+     }
+     for(i = 1; i < ntimer; ++i)
+          countdown_start(&timer[i].countdown, ttyclock->countdown.clock, timer[i].length);
+
+     if(ttyclock->countdown.clock != CLOCK_VIRTUAL)
+     {
+          splitfd = timerfd_create(ttyclock->countdown.clock, TFD_NONBLOCK | TFD_CLOEXEC);
+          if(splitfd < 0)
+          {
+               fprintf(stderr, "tty-pomodoro: error: couldn't set up the split timer: %s.\n",
+                       strerror(errno));
+               exit(EXIT_FAILURE);
+          }
+          loop_add(splitfd, POLLIN, split_event, NULL);
+     }
+     layout.bold = ttyclock->option.bold;
+     layout.font = ttyclock->option.font;
+     split_layout();
+     arm_split();
+
+     return;
+}
+
+void split_close(void){
+     int i;
+
+     for(i = 0; i < ntimer; ++i)
+          if(timer[i].win)
+          {
+               delwin(timer[i].win);
+               timer[i].win = NULL;
+          }
+     if(splitfd >= 0)
+     {
+          loop_del(splitfd);
+          close(splitfd);
+          splitfd = -1;
+     }
+     ntimer = 0;
+
+     return;
+}
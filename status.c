@@ -0,0 +1,165 @@
+/*
+ *      tty-pomodoro state published for status bars and prompts (--query).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      The running timer keeps a status_t in the POSIX shared memory
+ *      segment /tty-pomodoro-<uid>, rewritten whenever the countdown
+ *      changes (arm_timer()), never on a tick: readers work the time left
+ *      out of the deadline and the clock it is on. The segment is guarded
+ *      by a seqlock: the writer makes seq odd, writes, and makes it even
+ *      again, so it never waits for anyone. A reader copies the state and
+ *      keeps the copy if seq was even and unchanged around it; a few loads
+ *      from a mapping it keeps open, so a status bar can poll it freely.
+ *
+ *      A timer that died without cleaning up is told by its pid.
+ */
+
+#include "ttypomodoro.h"
+#include <sys/mman.h>
+
+/* Reads torn by a writer before giving up */
+#define STATUS_RETRIES 1000
+
+static status_t *status = MAP_FAILED;
+
+static const char *status_name(void){
+     static char name[32];
+
+     snprintf(name, sizeof(name), "/tty-pomodoro-%u", (unsigned int)getuid());
+
+     return name;
+}
+
+/* Take over the segment, from a timer before us if need be */
+int status_open(void){
+     int fd;
+
+     if((fd = shm_open(status_name(), O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+          return -1;
+     if(ftruncate(fd, sizeof(status_t)) < 0)
+     {
+          close(fd);
+          return -1;
+     }
+     status = mmap(NULL, sizeof(status_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+     close(fd);
+
+     return status == MAP_FAILED ? -1 : 0;
+}
+
+/* Publish the countdown as it is now */
+void status_publish(void){
+     const countdown_t *cd = &ttyclock->countdown;
+     const schedule_t *plan;
+     status_t s;
+     uint32_t seq;
+     int n;
+
+     if(status == MAP_FAILED)
+          return;
+
+     memset(&s, 0, sizeof(s));
+     s.magic = STATUS_MAGIC;
+     s.pid = getpid();
+     s.clock = cd->clock;
+     s.phase = ttyclock->phase;
+     s.paused = cd->paused;
+     s.cycle = ttyclock->cycle;
+     s.deadline = cd->deadline;
+     s.left = MAX(countdown_left(cd), 0);
+     s.length = cd->length;
+     if(!cd->paused)
+          s.end = clock_ns(CLOCK_REALTIME) + s.left;
+     plan = schedule_get(&n);
+     s.next = n > 1 ? plan[1].phase : STATUS_NONE;
+     if(ttyclock->option.tag)
+          strncpy(s.tag, ttyclock->option.tag, sizeof(s.tag));
+
+     /* Odd while writing; the fence keeps the fields after it */
+     seq = status->seq;
+     __atomic_store_n(&status->seq, seq + 1, __ATOMIC_RELAXED);
+     __atomic_thread_fence(__ATOMIC_RELEASE);
+     s.seq = seq + 1;
+     memcpy(status, &s, sizeof(s));
+     __atomic_store_n(&status->seq, seq + 2, __ATOMIC_RELEASE);
+
+     return;
+}
+
+/* Leave nothing behind, unless a newer timer took the segment over */
+void status_close(void){
+     if(status == MAP_FAILED)
+          return;
+
+     if(status->pid == getpid())
+          shm_unlink(status_name());
+     munmap(status, sizeof(status_t));
+     status = MAP_FAILED;
+
+     return;
+}
+
+/* Map the running timer's segment for reading, NULL if there is none */
+const status_t *status_map(void){
+     const status_t *map;
+     int fd;
+
+     if((fd = shm_open(status_name(), O_RDONLY | O_CLOEXEC, 0)) < 0)
+          return NULL;
+     map = mmap(NULL, sizeof(status_t), PROT_READ, MAP_SHARED, fd, 0);
+     close(fd);
+
+     return map == MAP_FAILED ? NULL : map;
+}
+
+/* A consistent copy of a mapped status_t, -1 if none after STATUS_RETRIES */
+int status_read(const status_t *map, status_t *s){
+     uint32_t seq;
+     int i;
+
+     for(i = 0; i < STATUS_RETRIES; ++i)
+     {
+          if((seq = __atomic_load_n(&map->seq, __ATOMIC_ACQUIRE)) & 1)
+               continue;
+          memcpy(s, (const void *)map, sizeof(*s));
+          __atomic_thread_fence(__ATOMIC_ACQUIRE);
+          if(__atomic_load_n(&map->seq, __ATOMIC_RELAXED) == seq)
+               return s->magic == STATUS_MAGIC ? 0 : -1;
+     }
+
+     return -1;
+}
+
+/* --query: print "<phase> <mm:ss> <running|paused> <cycle> [<tag>]" for
+ * the running timer; exit status 1 if there is none */
+int status_query(void){
+     const status_t *map;
+     struct timespec ts;
+     status_t s;
+     int64_t left;
+     int ret;
+
+     if(!(map = status_map()))
+          return EXIT_FAILURE;
+
+     ret = status_read(map, &s);
+     munmap((void *)map, sizeof(status_t));
+     if(ret < 0 || (kill(s.pid, 0) < 0 && errno == ESRCH))
+          return EXIT_FAILURE;
+
+     if(s.paused)
+          left = s.left;
+     else
+     {
+          clock_gettime(s.clock, &ts);
+          left = MAX(s.deadline - (ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec), 0);
+     }
+     /* Rounded up, as the timer shows it */
+     left = (left + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+
+     printf("%s %02d:%02d %s %u%s%.*s\n", schedule_phase_name(s.phase),
+            (int)(left / 60), (int)(left % 60), s.paused ? "paused" : "running", s.cycle,
+            *s.tag ? " " : "", (int)sizeof(s.tag), s.tag);
+
+     return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/*
+ *      tty-pomodoro line output (--stream).
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      For status bars that keep a process running (i3blocks, waybar,
+ *      tmux): no terminal is set up, and draw_terms() hands each frame of
+ *      the usual tick engine to stream_frame(). That formats what the
+ *      timer would show and writes it as one line, in one write(), only
+ *      when it differs from the line before.
+ *
+ *      Format escapes: %p phase, %n next phase (--cycle), %t mm:ss,
+ *      %m minutes, %s seconds, %r seconds left, %S running or paused,
+ *      %c cycle position, %T tag, %% a %. "json" writes an object instead.
+ *
+ *      stdout is never waited for, except by a simulation. A line stdout
+ *      can't take yet waits and is replaced by any newer one, so a slow
+ *      reader gets the current value when it reads again, never a
+ *      backlog. A reader gone away (EPIPE, POLLERR) ends the run.
+ */
+
+#include "ttypomodoro.h"
+
+#define STREAMBUF 512
+/* Formatted text stops here, leaving room for the closing characters */
+#define STREAMROOM (STREAMBUF - 8)
+
+/* Last line written, and the one waiting for stdout */
+static char last[STREAMBUF], line[STREAMBUF];
+static size_t len;
+static Bool pending;
+
+/* Append what s points at, JSON string escaped if quote */
+static size_t append(char *buf, size_t n, const char *s, Bool quote){
+     for(; *s && n < STREAMROOM; ++s)
+     {
+          if((unsigned char)*s < ' ')
+               continue;
+          if(quote && (*s == '"' || *s == '\\'))
+               buf[n++] = '\\';
+          buf[n++] = *s;
+     }
+
+     return n;
+}
+
+static size_t format(char *buf){
+     const remaining_t *r = &ttyclock->remaining;
+     const char *fmt = ttyclock->option.stream;
+     const char *tag = ttyclock->option.tag ? ttyclock->option.tag : "";
+     const char *state = ttyclock->countdown.paused ? "paused" : "running";
+     const char *next = "";
+     const schedule_t *plan;
+     char v[64];
+     size_t n = 0;
+     int nplan;
+
+     plan = schedule_get(&nplan);
+     if(nplan > 1)
+          next = schedule_phase_name(plan[1].phase);
+
+     if(!strcmp(fmt, "json"))
+     {
+          n = snprintf(buf, STREAMBUF, "{\"phase\": \"%s\", \"next\": \"%s\", \"left\": %u, "
+                       "\"text\": \"%02u:%02u\", \"state\": \"%s\", \"cycle\": %u, \"tag\": \"",
+                       schedule_phase_name(ttyclock->phase), next, r->minutes * 60 + r->seconds,
+                       r->minutes, r->seconds, state, ttyclock->cycle);
+          n = append(buf, n, tag, True);
+          buf[n++] = '"';
+          buf[n++] = '}';
+          buf[n++] = '\n';
+          return n;
+     }
+
+     for(; *fmt && n < STREAMROOM; ++fmt)
+     {
+          if(*fmt != '%' || !fmt[1])
+          {
+               buf[n++] = *fmt;
+               continue;
+          }
+          switch(*++fmt)
+          {
+          case 'p': snprintf(v, sizeof(v), "%s", schedule_phase_name(ttyclock->phase)); break;
+          case 'n': snprintf(v, sizeof(v), "%s", next); break;
+          case 't': snprintf(v, sizeof(v), "%02u:%02u", r->minutes, r->seconds); break;
+          case 'm': snprintf(v, sizeof(v), "%02u", r->minutes); break;
+          case 's': snprintf(v, sizeof(v), "%02u", r->seconds); break;
+          case 'r': snprintf(v, sizeof(v), "%u", r->minutes * 60 + r->seconds); break;
+          case 'S': snprintf(v, sizeof(v), "%s", state); break;
+          case 'c': snprintf(v, sizeof(v), "%u", ttyclock->cycle); break;
+          case 'T': snprintf(v, sizeof(v), "%.8s", tag); break;
+          default:  snprintf(v, sizeof(v), "%c", *fmt); break;
+          }
+          n = append(buf, n, v, False);
+     }
+     buf[n++] = '\n';
+
+     return n;
+}
+
+/* Write the waiting line if stdout takes it now */
+static void flush(void){
+     struct pollfd p = { STDOUT_FILENO, POLLOUT, 0 };
+     ssize_t n;
+
+     if(!pending)
+          return;
+
+     /* Lines are below PIPE_BUF: a writable pipe takes them whole. A
+      * simulation waits for its reader rather than skip ahead of it. */
+     if(poll(&p, 1, ttyclock->countdown.clock == CLOCK_VIRTUAL ? -1 : 0) <= 0
+        || !(p.revents & POLLOUT))
+     {
+          loop_set_events(STDOUT_FILENO, POLLOUT);
+          return;
+     }
+     while((n = write(STDOUT_FILENO, line, len)) < 0 && errno == EINTR);
+     if(n < 0)
+     {
+          if(errno == EAGAIN)
+               return;
+          /* EPIPE: nobody reads us any more */
+          ttyclock->running = False;
+          return;
+     }
+     ++ttyclock->stats.stream_lines;
+     memcpy(last, line, len);
+     last[len] = '\0';
+     pending = False;
+     loop_set_events(STDOUT_FILENO, 0);
+
+     return;
+}
+
+static void stream_event(int fd, short revents, void *arg){
+     if(revents & (POLLERR | POLLHUP))
+     {
+          ttyclock->running = False;
+          loop_del(fd);
+          return;
+     }
+     flush();
+
+     return;
+}
+
+/* Stream to stdout instead of drawing */
+void stream_open(void){
+     /* EPIPE instead of dying from it */
+     signal(SIGPIPE, SIG_IGN);
+     loop_add(STDOUT_FILENO, 0, stream_event, NULL);
+
+     return;
+}
+
+/* The frame update_hour() computed, as a line if it changed */
+void stream_frame(void){
+     char buf[STREAMBUF];
+     size_t n = format(buf);
+
+     buf[n] = '\0';
+     if(pending && !strcmp(buf, line))
+          return;
+
+     /* A newer value replaces one still waiting */
+     if(pending)
+     {
+          ++ttyclock->stats.stream_dropped;
+          pending = False;
+          loop_set_events(STDOUT_FILENO, 0);
+     }
+     if(!strcmp(buf, last))
+          return;
+     memcpy(line, buf, n + 1);
+     len = n;
+     pending = True;
+     flush();
+
+     return;
+}
@@ -0,0 +1,277 @@
+/*
+ *      tty-pomodoro output terminals.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Without -T there is a single terminal on stdin/stdout and ncurses
+ *      writes to it directly. Every -T terminal instead gets a pipe:
+ *      ncurses renders into the pipe and term_flush() forwards it to the
+ *      tty, which is opened non-blocking. A tty that stops reading only
+ *      fills its own queue; once term_backlog() passes TERMBACKLOG,
+ *      draw_terms() skips it until it has caught up.
+ *
+ *      With --ansi there is no ncurses screen: ansi.c writes to the same
+ *      fd ncurses would have, and the tty modes are set here.
+ */
+
+#include "ttypomodoro.h"
+
+/* cbreak + noecho on t's tty, restored by term_close() */
+static void term_mode(term_t *t){
+     struct termios mode;
+
+     if(tcgetattr(t->fd, &t->mode) == 0)
+     {
+          mode = t->mode;
+          mode.c_lflag &= ~(ICANON | ECHO);
+          mode.c_cc[VMIN] = 1;
+          mode.c_cc[VTIME] = 0;
+          tcsetattr(t->fd, TCSANOW, &mode);
+          t->moded = True;
+     }
+
+     return;
+}
+
+static int term_open_tty(term_t *t){
+     int p[2];
+
+     if((t->fd = open(t->path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) < 0)
+          return -1;
+
+     /* ncurses can't set the modes through a pipe */
+     term_mode(t);
+
+     if(pipe2(p, O_CLOEXEC) < 0)
+          return -1;
+     fcntl(p[0], F_SETFL, O_NONBLOCK);
+     /* A frame is far smaller than the pipe, so ncurses never blocks */
+     fcntl(p[1], F_SETPIPE_SZ, 1 << 20);
+
+     t->outfd = p[0];
+     t->out = fdopen(p[1], "w");
+     t->in = fdopen(dup(t->fd), "r");
+     if(!t->out || !t->in)
+          return -1;
+
+     if(ttyclock->option.ansi)
+          ansi_open(t);
+     else if(!(t->scr = newterm(NULL, t->out, t->in)))
+          return -1;
+     else
+          set_term(t->scr);
+     term_resize(t);
+
+     return 0;
+}
+
+/* Send seq to t now, in line with what ncurses or ansi.c sent before */
+void term_report(term_t *t, const char *seq){
+     FILE *out = (t->outfd >= 0) ? t->out : stdout;
+
+     fputs(seq, out);
+     fflush(out);
+     if(t->outfd >= 0)
+          term_flush(t);
+
+     return;
+}
+
+static int term_open_any(term_t *t){
+     t->outfd = -1;
+
+     if(t->path)
+          return term_open_tty(t);
+
+     t->fd = STDIN_FILENO;
+     if(ttyclock->option.ansi)
+     {
+          term_mode(t);
+          ansi_open(t);
+          term_resize(t);
+          return 0;
+     }
+
+     if(!(t->scr = newterm(NULL, stdout, stdin)))
+          return -1;
+     set_term(t->scr);
+     t->lines = LINES;
+     t->cols = COLS;
+
+     return 0;
+}
+
+/* Open t->path, or stdin/stdout when it is NULL. The terminal reports
+ * focus changes (ESC [ I, ESC [ O), so key_event() can ask whether it
+ * was iconified. */
+int term_open(term_t *t){
+     if(term_open_any(t) < 0)
+          return -1;
+     term_report(t, "\033[?1004h");
+
+     return 0;
+}
+
+/* Make t the current terminal */
+void term_select(term_t *t){
+     term_t *cur = ttyclock->cur;
+
+     if(cur == t)
+          return;
+
+     if(cur)
+     {
+          cur->scr = ttyclock->ttyscr;
+          cur->framewin = ttyclock->framewin;
+          cur->datewin = ttyclock->datewin;
+          cur->barwin = ttyclock->barwin;
+          cur->geo = ttyclock->geo;
+          cur->frame = ttyclock->frame;
+     }
+
+     ttyclock->ttyscr = t->scr;
+     ttyclock->framewin = t->framewin;
+     ttyclock->datewin = t->datewin;
+     ttyclock->barwin = t->barwin;
+     ttyclock->geo = t->geo;
+     ttyclock->frame = t->frame;
+     ttyclock->cur = t;
+
+     if(t->scr)
+          set_term(t->scr);
+
+     return;
+}
+
+/* Pick up the new size of t's tty; False if it hasn't changed */
+Bool term_resize(term_t *t){
+     struct winsize ws;
+     int fd = (t->outfd >= 0) ? t->fd : STDOUT_FILENO;
+     int lines = t->lines, cols = t->cols;
+
+     if(ttyclock->option.ansi)
+     {
+          t->lines = 24;
+          t->cols = 80;
+          if(ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col)
+          {
+               t->lines = ws.ws_row;
+               t->cols = ws.ws_col;
+          }
+          return (t->lines != lines || t->cols != cols);
+     }
+
+     if(ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col
+        && (ws.ws_row != lines || ws.ws_col != cols))
+          resizeterm(ws.ws_row, ws.ws_col);
+     t->lines = LINES;
+     t->cols = COLS;
+
+     return (t->lines != lines || t->cols != cols);
+}
+
+/* Bytes rendered for t that the tty hasn't accepted yet */
+size_t term_backlog(term_t *t){
+     int n = 0;
+
+     if(t->outfd < 0)
+          return 0;
+     ioctl(t->outfd, FIONREAD, &n);
+
+     return (t->len - t->off) + n;
+}
+
+/* t hung up or can't be written to: drop it. Losing a -T mirror leaves
+ * the others running; losing the terminal started on stops the run. */
+void term_lost(term_t *t){
+     if(!t->path)
+          ttyclock->running = False;
+     t->dead = True;
+     loop_del(t->fd);
+
+     return;
+}
+
+/* Forward what ncurses wrote for t until the pipe is empty or the tty
+ * would block; in the latter case wait for POLLOUT on the tty. */
+void term_flush(term_t *t){
+     ssize_t n;
+
+     if(t->outfd < 0 || t->dead)
+          return;
+
+     for(;;)
+     {
+          if(t->off == t->len)
+          {
+               t->off = t->len = 0;
+               if((n = read(t->outfd, t->buf, sizeof(t->buf))) <= 0)
+                    break;
+               t->len = n;
+          }
+
+          if((n = write(t->fd, t->buf + t->off, t->len - t->off)) < 0)
+          {
+               if(errno == EINTR)
+                    continue;
+               if(errno != EAGAIN)
+               {
+                    term_lost(t);
+                    return;
+               }
+               break;
+          }
+          t->off += n;
+          t->stats.bytes += n;
+     }
+
+     loop_set_events(t->fd, POLLIN | (t->off < t->len ? POLLOUT : 0));
+
+     return;
+}
+
+void term_close(term_t *t){
+     struct pollfd p;
+     int i;
+
+     if(!t->scr && !t->ansi.fd)
+          return;
+
+     term_select(t);
+     term_report(t, "\033[?1004l");
+     if(t->scr)
+          endwin();
+     else
+          ansi_close(t);
+
+     if(t->outfd >= 0)
+     {
+          /* Give the tty a moment to take what is left, then restore it */
+          p.fd = t->fd;
+          p.events = POLLOUT;
+          for(i = 0; i < 5 && !t->dead; ++i)
+          {
+               term_flush(t);
+               if(!term_backlog(t) || poll(&p, 1, 100) <= 0)
+                    break;
+          }
+     }
+     if(t->moded)
+          tcsetattr(t->fd, TCSANOW, &t->mode);
+
+     if(t->scr)
+          delscreen(t->scr);
+     t->scr = NULL;
+     ttyclock->ttyscr = NULL;
+     ttyclock->cur = NULL;
+
+     loop_del(t->fd);
+     if(t->outfd >= 0)
+     {
+          fclose(t->out);
+          fclose(t->in);
+          close(t->outfd);
+          close(t->fd);
+     }
+
+     return;
+}
@@ -0,0 +1,300 @@
+/*
+ *      tty-pomodoro replay test.
+ *      See ttypomodoro.c for the license detail.
+ *
+ *      Plays randomized --cycle schedules on the virtual clock: random
+ *      phases and lengths, --auto or not, random waits with fractions of
+ *      a second, pauses and resumes, and stalls: the clock jumping on by
+ *      several phases at once, as after a SIGSTOP or a suspend. The ticks
+ *      go through sim_tick() and so the real update_hour()/draw_terms()
+ *      path, drawn with the ANSI backend into /dev/null. At every tick
+ *      the digits the terminal was sent (ansi_t.front) are read back and
+ *      checked against a model of the schedule kept here, which knows
+ *      nothing of countdown.c.
+ *
+ *      A countdown without --cycle ends the process, so only cycles are
+ *      played, and a cycle that ends one fails the test.
+ *
+ *      test/replay [schedules [seed]] exits 1 at the first wrong digit,
+ *      with the seed, the schedule and the step that led there.
+ */
+
+#include "../ttypomodoro.h"
+
+#define REPLAY_SCHEDULES 2000
+#define REPLAY_STEPS     40
+/* Longest wait between two steps, in ms */
+#define REPLAY_WAIT_MS   90000
+/* Longest stall, in ms */
+#define REPLAY_STALL_MS  900000
+
+/* Pair of a cell in ansi_t.front (see ansi.c): 1 is a lit pixel */
+#define CELL_PAIR(c) ((c) & 3)
+
+/* What the timer should show, worked out on its own */
+typedef struct
+{
+     int64_t length[SCHEDULE_MAX];
+     int n, pos;
+     int64_t left, now;
+     Bool paused, autoadvance;
+} model_t;
+
+/* The built-in digits, row by row, as they should look */
+static const char *shape[10] =
+{
+     "111101101101111", "001001001001001", "111001111100111", "111001111001111",
+     "101101111001001", "111100111001111", "111100111101111", "111001001001001",
+     "111101111101111", "111101111001111"
+};
+
+static const char *phase_name[] = { "work", "short", "long" };
+static const int phase_minutes[] = { DEFAULT_TIME, SHORT_BREAK, LONG_BREAK };
+
+static model_t model;
+static char spec[512];
+static unsigned long ticks, pauses, stalls;
+/* The seed of the schedule being played, if one is */
+static unsigned int seed_playing;
+static Bool playing;
+
+/* Append one random phase to spec and the model */
+static void gen_phase(size_t *len, int64_t *out, int *n){
+     int p = rand() % 3, k = rand() % 10;
+     int64_t secs;
+
+     if(k == 0)
+     {
+          /* At its default length, now and then */
+          secs = phase_minutes[p] * 60;
+          *len += sprintf(spec + *len, "%s", phase_name[p]);
+     }
+     else if(k < 3)
+     {
+          secs = (1 + rand() % 2) * 60;
+          *len += sprintf(spec + *len, "%s:%d", phase_name[p], (int)(secs / 60));
+     }
+     else
+     {
+          secs = 1 + rand() % 150;
+          *len += sprintf(spec + *len, "%s:%ds", phase_name[p], (int)secs);
+     }
+     out[(*n)++] = secs * NSEC_PER_SEC;
+
+     return;
+}
+
+/* A random spec, e.g. "2x(work:31s,short:1),long:7s", expanded in model */
+static void gen_spec(void){
+     int64_t group[3];
+     int i, j, r, items = 1 + rand() % 4, repeat, width, ngroup;
+     size_t len = 0;
+
+     model.n = 0;
+     for(i = 0; i < items; ++i)
+     {
+          if(i)
+               spec[len++] = ',';
+          if(rand() % 3)
+          {
+               gen_phase(&len, model.length, &model.n);
+               continue;
+          }
+          repeat = 1 + rand() % 3;
+          width = 1 + rand() % 3;
+          len += sprintf(spec + len, "%dx(", repeat);
+          for(j = 0, ngroup = 0; j < width; ++j)
+          {
+               if(j)
+                    spec[len++] = ',';
+               gen_phase(&len, group, &ngroup);
+          }
+          spec[len++] = ')';
+          for(r = 0; r < repeat; ++r)
+               for(j = 0; j < ngroup; ++j)
+                    model.length[model.n++] = group[j];
+     }
+     spec[len] = '\0';
+
+     return;
+}
+
+/* Let the model's time get to t */
+static void model_to(int64_t t){
+     int64_t d = t - model.now;
+
+     model.now = t;
+     while(!model.paused && d > 0)
+     {
+          if(d < model.left)
+          {
+               model.left -= d;
+               break;
+          }
+          /* The phase ends: on to the next, or wait for 'p' */
+          d -= model.left;
+          model.pos = (model.pos + 1) % model.n;
+          model.left = model.length[model.pos];
+          if(!model.autoadvance)
+               model.paused = True;
+     }
+
+     return;
+}
+
+/* The digit in slot y of the frame, -1 if it is none */
+static int shown_digit(int y){
+     const ansi_t *a = &ttyclock->cur->ansi;
+     int s = ttyclock->geo.scale, n, i;
+
+     for(n = 0; n < 10; ++n)
+     {
+          for(i = 0; i < 15; ++i)
+               if((CELL_PAIR(a->front[1 + (i / 3) * s][y + (i % 3) * 2 * s]) == 1) != (shape[n][i] == '1'))
+                    break;
+          if(i == 15)
+               return n;
+     }
+
+     return -1;
+}
+
+static void check(unsigned int seed, int step){
+     static const int slot_y[4] = { 1, 8, 20, 27 };
+     int s = ttyclock->geo.scale, i, want[4], got[4];
+     int64_t secs = (model.left + NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+     Bool ok = True;
+
+     want[0] = secs / 60 / 10 % 10;
+     want[1] = secs / 60 % 10;
+     want[2] = secs % 60 / 10;
+     want[3] = secs % 10;
+     for(i = 0; i < 4; ++i)
+          ok &= (got[i] = shown_digit(1 + (slot_y[i] - 1) * s)) == want[i];
+     ++ticks;
+     if(ok)
+          return;
+
+     fprintf(stderr, "replay: seed %u, --cycle '%s'%s, step %d, phase %d, %s: "
+             "shows %d%d:%d%d, should show %d%d:%d%d.\n",
+             seed, spec, model.autoadvance ? " --auto" : "", step, model.pos,
+             model.paused ? "paused" : "running",
+             got[0], got[1], got[2], got[3], want[0], want[1], want[2], want[3]);
+     exit(EXIT_FAILURE);
+}
+
+/* time_ended() exits: a cycle must never get there */
+static void ended(void){
+     if(!playing)
+          return;
+     fprintf(stderr, "replay: seed %u, --cycle '%s'%s: the cycle ended the process.\n",
+             seed_playing, spec, model.autoadvance ? " --auto" : "");
+     _exit(EXIT_FAILURE);
+}
+
+static void replay(unsigned int seed, int devnull){
+     term_t *t = &ttyclock->term[0];
+     int64_t until;
+     int i;
+
+     srand(seed);
+     seed_playing = seed;
+     playing = True;
+     memset(ttyclock, 0, sizeof(*ttyclock));
+     ttyclock->option.format = "%F";
+     ttyclock->option.color = COLOR_RED;
+     ttyclock->option.delay = 1;
+     ttyclock->option.ansi = True;
+     ttyclock->option.scale = 1 + rand() % ANSISCALE;
+     ttyclock->option.blink = rand() % 2;
+     ttyclock->option.box = rand() % 2;
+     ttyclock->option.autoadvance = model.autoadvance = rand() % 2;
+
+     gen_spec();
+     if(schedule_parse(spec) < 0)
+     {
+          fprintf(stderr, "replay: error: seed %u, --cycle '%s' doesn't parse.\n", seed, spec);
+          exit(EXIT_FAILURE);
+     }
+     countdown_start(&ttyclock->countdown, CLOCK_VIRTUAL, schedule_begin());
+     schedule_plan();
+     model.pos = 0;
+     model.left = model.length[0];
+     model.paused = False;
+     model.now = clock_ns(CLOCK_VIRTUAL);
+
+     ttyclock->nterm = 1;
+     t->fd = devnull;
+     t->outfd = -1;
+     t->lines = 40;
+     t->cols = 200;
+     ansi_open(t);
+     t->ansi.fd = devnull;
+     term_select(t);
+     init();
+     draw_terms();
+     check(seed, 0);
+
+     for(i = 1; i <= REPLAY_STEPS; ++i)
+     {
+          if(rand() % 5 == 0)
+          {
+               toggle_pause();
+               draw_terms();
+               model.paused = !model.paused;
+               ++pauses;
+               check(seed, i);
+               continue;
+          }
+          if(rand() % 8 == 0)
+          {
+               /* Stopped, then woken at once past what would have ticked */
+               until = clock_ns(CLOCK_VIRTUAL) + (int64_t)(rand() % REPLAY_STALL_MS) * 1000000;
+               clock_set_virtual(until);
+               update_hour();
+               draw_terms();
+               model_to(until);
+               ++stalls;
+               check(seed, i);
+               continue;
+          }
+          until = clock_ns(CLOCK_VIRTUAL) + (int64_t)(rand() % REPLAY_WAIT_MS) * 1000000
+               + rand() % 1000000;
+          while(sim_tick(until))
+          {
+               model_to(clock_ns(CLOCK_VIRTUAL));
+               check(seed, i);
+          }
+          model_to(until);
+     }
+
+     ansi_close(t);
+     playing = False;
+
+     return;
+}
+
+int main(int argc, char **argv){
+     int n = argc > 1 ? atoi(argv[1]) : REPLAY_SCHEDULES;
+     unsigned int seed = argc > 2 ? strtoul(argv[2], NULL, 10) : time(NULL);
+     int64_t start = clock_ns(CLOCK_MONOTONIC);
+     int i, devnull;
+
+     if((devnull = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+     {
+          fprintf(stderr, "replay: error: couldn't open /dev/null: %s.\n", strerror(errno));
+          return EXIT_FAILURE;
+     }
+     ttyclock = malloc(sizeof(ttyclock_t));
+     assert(ttyclock != NULL);
+     atexit(ended);
+
+     for(i = 0; i < n; ++i)
+          replay(seed + i, devnull);
+
+     printf("replay: %d schedules from seed %u, %lu ticks, %lu pauses, %lu stalls checked in %.0f ms.\n",
+            n, seed, ticks, pauses, stalls, (clock_ns(CLOCK_MONOTONIC) - start) / 1e6);
+     free(ttyclock);
+
+     return EXIT_SUCCESS;
+}
@@ -32,72 +32,67 @@
 
 #include "ttypomodoro.h"
 
-static time_t start_time;
-static unsigned int start_minutes;
+/* Global variable */
+ttyclock_t *ttyclock;
 
-void init(void){
-     struct sigaction sig;
-     ttyclock->bg = COLOR_BLACK;
+static void tty_event(int fd, short revents, void *arg);
 
-     /* Init ncurses */
-     if (ttyclock->tty) {
-	     FILE *ftty = fopen(ttyclock->tty, "r+");
-	     if (!ftty) {
-		     fprintf(stderr, "tty-clock: error: '%s' couldn't be opened: %s.\n",
-				     ttyclock->tty, strerror(errno));
-		     exit(EXIT_FAILURE);
-	     }
-	     ttyclock->ttyscr = newterm(NULL, ftty, ftty);
-	     assert(ttyclock->ttyscr != NULL);
-	     set_term(ttyclock->ttyscr);
-     } else
-	     initscr();
-
-     cbreak();
-     noecho();
-     keypad(stdscr, True);
-     start_color();
-     curs_set(False);
-     clear();
-
-     /* Init default terminal color */
-     if(use_default_colors() == OK)
-          ttyclock->bg = -1;
-
-     /* Init color pair */
-     init_pair(0, ttyclock->bg, ttyclock->bg);
-     init_pair(1, ttyclock->bg, ttyclock->option.color);
-     init_pair(2, ttyclock->option.color, ttyclock->bg);
-     refresh();
-
-     /* Init signal handler */
-     sig.sa_handler = signal_handler;
-     sig.sa_flags   = 0;
-     sigaction(SIGWINCH, &sig, NULL);
-     sigaction(SIGTERM,  &sig, NULL);
-     sigaction(SIGINT,   &sig, NULL);
-     sigaction(SIGSEGV,  &sig, NULL);
+/* Open every output terminal and set each one up with init() */
+void init_terms(void){
+     term_t *t;
+     int i;
 
-     /* Init global struct */
-     ttyclock->running = True;
-     if(!ttyclock->geo.x)
-          ttyclock->geo.x = 0;
-     if(!ttyclock->geo.y)
-          ttyclock->geo.y = 0;
-     if(!ttyclock->geo.a)
-          ttyclock->geo.a = 1;
-     if(!ttyclock->geo.b)
-          ttyclock->geo.b = 1;
-     ttyclock->geo.w = (ttyclock->option.second) ? SECFRAMEW : NORMFRAMEW;
-     ttyclock->geo.h = 7;
-     ttyclock->tm = localtime(&(ttyclock->lt));
-     if(ttyclock->option.utc) {
-         ttyclock->tm = gmtime(&(ttyclock->lt));
+     /* No -T: the terminal we were started from */
+     if(!ttyclock->nterm)
+          ttyclock->nterm = 1;
+
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          if(term_open(t) < 0)
+          {
+               fprintf(stderr, "tty-clock: error: '%s' couldn't be opened: %s.\n",
+                       t->path ? t->path : "stdout", strerror(errno));
+               exit(EXIT_FAILURE);
+          }
+          loop_add(t->fd, POLLIN, tty_event, t);
+
+          term_select(t);
+          init();
+          term_flush(t);
      }
-     ttyclock->lt = time(NULL);
-     update_hour();
 
+     return;
+}
+
+/* The option's digit scale, or the largest at which a frame w wide at
+ * scale 1 fits the current terminal */
+static int fit_scale(int w){
+     int max = ttyclock->option.ansi ? ANSISCALE : MAXSCALE;
+     int lines = ttyclock->cur->lines - (ttyclock->option.date ? DATEWINH : ttyclock->option.progress);
+     int s = ttyclock->option.scale;
+
+     if(!s)
+          for(s = max; s > 1 && (FRAMEW(w, s) > ttyclock->cur->cols || FRAMEH(s) > lines); --s);
+
+     return MAX(MIN(s, max), 1);
+}
+
+/* The progress bar's row: under the frame, or under the date box */
+static int bar_row(void){
+     return ttyclock->geo.x + ttyclock->geo.h + (ttyclock->option.date ? DATEWINH - 1 : 0);
+}
+
+/* The current terminal's ncurses windows for the frame, the date and the
+ * progress bar */
+static void init_windows(void){
      /* Create clock win */
+     if(ttyclock->framewin)
+          delwin(ttyclock->framewin);
+     if(ttyclock->datewin)
+          delwin(ttyclock->datewin);
+     if(ttyclock->barwin)
+          delwin(ttyclock->barwin);
      ttyclock->framewin = newwin(ttyclock->geo.h,
                                  ttyclock->geo.w,
                                  ttyclock->geo.x,
@@ -121,10 +116,23 @@ void init(void){
      }
      clearok(ttyclock->datewin, True);
 
+     /* The bar, as wide as the inside of the frame */
+     ttyclock->barwin = ttyclock->option.progress
+          ? newwin(1, MAX(ttyclock->geo.w - 2, 1), bar_row(), ttyclock->geo.y + 1)
+          : NULL;
+
+     /* Let the rebound animation scroll the frame (see clock_shift()) */
+     idlok(ttyclock->framewin, True);
+     invalidate_frame();
+
      set_center(ttyclock->option.center);
 
      nodelay(stdscr, True);
 
+     /* Tiles instead, see split_layout() */
+     if (split_active())
+          return;
+
      if (ttyclock->option.date)
      {
           wrefresh(ttyclock->datewin);
@@ -132,18 +140,102 @@ void init(void){
 
      wrefresh(ttyclock->framewin);
 
-     /* Initialize the start timer */
-     start_time = time(0);
+     return;
+}
+
+/* Set up the current terminal's screen and windows */
+void init(void){
+     ttyclock->bg = COLOR_BLACK;
+
+     if(!ttyclock->option.ansi)
+     {
+          /* Init ncurses */
+          cbreak();
+          noecho();
+          keypad(stdscr, True);
+          /* Focus and window state reports, see term_open() */
+          define_key("\033[I", KEY_FOCUSIN);
+          define_key("\033[O", KEY_FOCUSOUT);
+          define_key("\033[1t", KEY_SHOWN);
+          define_key("\033[2t", KEY_ICONIFIED);
+          start_color();
+          curs_set(False);
+          clear();
+
+          /* Init default terminal color */
+          if(use_default_colors() == OK)
+               ttyclock->bg = -1;
+
+          /* Init color pair */
+          init_pair(0, ttyclock->bg, ttyclock->bg);
+          init_pair(1, ttyclock->bg, ttyclock->option.color);
+          init_pair(2, ttyclock->option.color, ttyclock->bg);
+          refresh();
+     }
+
+     /* Init global struct */
+     ttyclock->running = True;
+     if(!ttyclock->geo.x)
+          ttyclock->geo.x = 0;
+     if(!ttyclock->geo.y)
+          ttyclock->geo.y = 0;
+     if(!ttyclock->geo.a)
+          ttyclock->geo.a = 1;
+     if(!ttyclock->geo.b)
+          ttyclock->geo.b = 1;
+     ttyclock->geo.scale = fit_scale((ttyclock->option.second) ? SECFRAMEW : NORMFRAMEW);
+     ttyclock->geo.w = FRAMEW((ttyclock->option.second) ? SECFRAMEW : NORMFRAMEW, ttyclock->geo.scale);
+     ttyclock->geo.h = FRAMEH(ttyclock->geo.scale);
+     ttyclock->tm = localtime(&(ttyclock->lt));
+     if(ttyclock->option.utc) {
+         ttyclock->tm = gmtime(&(ttyclock->lt));
+     }
+     ttyclock->lt = clock_ns(CLOCK_REALTIME) / NSEC_PER_SEC;
+     update_hour();
+
+     if(ttyclock->option.ansi)
+     {
+          /* No windows: the frame is ansi.c's cell buffer */
+          ansi_init();
+          ansi_box(ttyclock->option.box);
+          invalidate_frame();
+          set_center(ttyclock->option.center);
+          ansi_flush();
+     }
+     else
+          init_windows();
+
+     /* What the terminal shows now */
+     ttyclock->cur->applied.box = ttyclock->option.box;
+     ttyclock->cur->applied.center = ttyclock->option.center;
+     ttyclock->cur->applied.second = ttyclock->option.second;
+     ttyclock->cur->applied.color = ttyclock->option.color;
+     ttyclock->cur->applied.font = ttyclock->option.font;
 
      return;
 }
 
+/* Called from the main loop for signals read off the signalfd, and
+ * directly from signal context for SIGSEGV only. */
 void signal_handler(int signal){
+     struct itimerspec its;
+
      switch(signal)
      {
      case SIGWINCH:
-          endwin();
-          init();
+          /* The first of a burst arms resize_event(), the rest fold in */
+          ++ttyclock->stats.winches;
+          timerfd_gettime(ttyclock->resizefd, &its);
+          if(!its.it_value.tv_sec && !its.it_value.tv_nsec)
+          {
+               memset(&its, 0, sizeof(its));
+               its.it_value.tv_nsec = RESIZEMS * 1000000L;
+               timerfd_settime(ttyclock->resizefd, 0, &its, NULL);
+          }
+          break;
+          /* 'p' for whoever has no keyboard, e.g. a --stream status bar */
+     case SIGUSR1:
+          toggle_pause();
           break;
           /* Interruption signal */
      case SIGINT:
@@ -161,161 +253,242 @@ void signal_handler(int signal){
      return;
 }
 
-void cleanup(void){
-	if (ttyclock->ttyscr)
-		delscreen(ttyclock->ttyscr);
-
-	if (ttyclock && ttyclock->tty)
-		free(ttyclock->tty);
-	if (ttyclock && ttyclock->option.format)
-		free(ttyclock->option.format);
-	if (ttyclock)
-		free(ttyclock);
-}
-
 void update_hour(void){
-     /* Static minute and hour counts so future calls can read previous values */
-     static unsigned int c_minute = 0, c_second = 0;
+     int64_t start = clock_ns(CLOCK_MONOTONIC);
 
-     /* Get current time */
-     time_t curr_time = time(0);
+     countdown_remaining(&ttyclock->countdown, &ttyclock->remaining);
+     ttyclock->stats.update_ns += clock_ns(CLOCK_MONOTONIC) - start;
 
-     /* Calculate the time remaining */
-     unsigned int time_diff = curr_time - start_time;
-     time_diff = start_minutes*60 - time_diff;
+     /* A viewer shows 00:00 until the timer says what comes next */
+     if (ttyclock->remaining.expired && share_viewing())
+        return;
 
-     /* Calculate seconds and minutes remaining */
-     c_second = time_diff - (c_minute*60);
-     c_second = c_second < 60 ? c_second : 0;
-     c_minute = time_diff/60;
-
-     if (c_minute == 0 && c_second == 0){
+     /* The end of a --cycle phase only swaps in the next one, or as many
+      * as went by while the process was stopped or the machine asleep */
+     while (ttyclock->remaining.expired && schedule_active()){
+        schedule_advance();
+        countdown_remaining(&ttyclock->countdown, &ttyclock->remaining);
+     }
+     if (ttyclock->remaining.expired){
         time_ended();
      }
-    
-     /* Set hour */
-     ttyclock->date.hour[0] = c_minute / 10;
-     ttyclock->date.hour[1] = c_minute % 10;
-
-     /* Set minutes */
-     ttyclock->date.minute[0] = c_second / 10;
-     ttyclock->date.minute[1] = c_second % 10;
 
      return;
 }
 
+/* Printed by cleanup() once the terminal is back */
 void time_ended(){
-    printf("Time ended!\n");
+    /* The 00:00 a terminal would never get to show */
+    if (ttyclock->option.stream)
+        stream_frame();
+    share_end();
+    checkpoint_clear();
+    journal_append(JOURNAL_COMPLETE);
+    journal_close();
+    notify_phase_end(ttyclock->phase, ttyclock->phase, True);
+    notify_stop(NOTIFY_DRAIN);
     exit(EXIT_SUCCESS);
     return;
 }
 
+/* w cells of colour pair `pair' from row x, column y of the frame */
+static void fill_span(int x, int y, int w, int pair){
+     if(ttyclock->option.ansi)
+          ansi_span(x, y, w, pair);
+     else
+     {
+          wbkgdset(ttyclock->framewin, COLOR_PAIR(pair));
+          mvwhline(ttyclock->framewin, x, y, ' ', w);
+     }
+     ttyclock->stats.cells += w;
+
+     return;
+}
+
+/* Glyph c of the current font with its top left corner at row x, column
+ * y, at the current scale, lit pixels in colour pair `pair' and the others
+ * cleared if erase */
+void draw_glyph(int c, int x, int y, int pair, Bool erase){
+     span_t sp[FONTSPANS];
+     int i, n;
+
+     if (ttyclock->option.bold)
+          wattron(ttyclock->framewin, A_BLINK);
+     else
+          wattroff(ttyclock->framewin, A_BLINK);
+
+     n = font_spans(c, ttyclock->geo.scale, pair, sp);
+     for(i = 0; i < n; ++i)
+          if(erase || sp[i].pair)
+               fill_span(x + sp[i].x, y + sp[i].y, sp[i].w, sp[i].pair);
+
+     return;
+}
+
 void draw_number(int n, int x, int y){
-     int i, sy = y;
+     draw_glyph('0' + n, x, y, 1, True);
 
-     for(i = 0; i < 30; ++i, ++sy)
-     {
-          if(sy == y + 6)
-          {
-               sy = y;
-               ++x;
-          }
+     return;
+}
 
-          if (ttyclock->option.bold)
-               wattron(ttyclock->framewin, A_BLINK);
-          else
-               wattroff(ttyclock->framewin, A_BLINK);
+/* Colon with its lit pixels from column y: the glyph is centred there,
+ * and only its dots change */
+void draw_colon(int y, int pair){
+     draw_glyph(':', 1, y - 2 * ttyclock->geo.scale, pair, False);
+
+     return;
+}
 
-          wbkgdset(ttyclock->framewin, COLOR_PAIR(number[n][i/2]));
-          mvwaddch(ttyclock->framewin, x, sy, ' ');
+/* Forget what is on screen so the next draw_clock() repaints every slot */
+void invalidate_frame(void){
+     int i;
+
+     for(i = 0; i < FRAMESLOTS; ++i)
+          ttyclock->frame.digit[i] = -1;
+     ttyclock->frame.colon[0] = ttyclock->frame.colon[1] = -1;
+     ttyclock->frame.bar = -1;
+
+     return;
+}
+
+/* The four digits shown for r: MM:SS, or HH:MM with --minutes, the
+ * minutes rounded up as the seconds are */
+void clock_digits(const remaining_t *r, int *digit){
+     unsigned int m = (r->minutes * 60 + r->seconds + 59) / 60;
+
+     if(!ttyclock->option.minutes)
+     {
+          memcpy(digit, r->digit, 4 * sizeof(*digit));
+          return;
      }
-     wrefresh(ttyclock->framewin);
+     digit[0] = m / 60 / 10 % 10;
+     digit[1] = m / 60 % 10;
+     digit[2] = m % 60 / 10;
+     digit[3] = m % 10;
 
      return;
 }
 
 void draw_clock(void){
-     /* Draw hour numbers */
-     draw_number(ttyclock->date.hour[0], 1, 1);
-     draw_number(ttyclock->date.hour[1], 1, 8);
-
-     if (ttyclock->option.blink){
-       time_t seconds;
-       seconds = time(NULL);
-
-       if (seconds % 2 != 0){
-           /* 2 dot for number separation */
-           wbkgdset(ttyclock->framewin, COLOR_PAIR(1));
-           mvwaddstr(ttyclock->framewin, 2, 16, "  ");
-           mvwaddstr(ttyclock->framewin, 4, 16, "  ");
-       }
-       else if (seconds % 2 == 0){
-           /*2 dot black for blinking */
-           wbkgdset(ttyclock->framewin, COLOR_PAIR(2));
-           mvwaddstr(ttyclock->framewin, 2, 16, "  ");
-           mvwaddstr(ttyclock->framewin, 4, 16, "  ");
-       }
-     }
-     else{
-       /* 2 dot for number separation */
-       wbkgdset(ttyclock->framewin, COLOR_PAIR(1));
-       mvwaddstr(ttyclock->framewin, 2, 16, "  ");
-       mvwaddstr(ttyclock->framewin, 4, 16, "  ");
-     }
-
-     /* Draw minute numbers */
-     draw_number(ttyclock->date.minute[0], 1, 20);
-     draw_number(ttyclock->date.minute[1], 1, 27);
+     /* Digit slots at scale 1: MM, SS then the optional seconds pair */
+     static const int slot_y[FRAMESLOTS] = { 1, 8, 20, 27, 39, 46 };
+     int s = ttyclock->geo.scale;
+     int digit[FRAMESLOTS] =
+     {
+          ttyclock->remaining.digit[0], ttyclock->remaining.digit[1],
+          ttyclock->remaining.digit[2], ttyclock->remaining.digit[3],
+          ttyclock->date.second[0],     ttyclock->date.second[1]
+     };
+     int i, nslot, colon = 1;
+     unsigned long cells = ttyclock->stats.cells;
+     int64_t start = clock_ns(CLOCK_MONOTONIC);
 
-     /* Draw the date */
-     if (ttyclock->option.bold)
-          wattron(ttyclock->datewin, A_BOLD);
-     else
-          wattroff(ttyclock->datewin, A_BOLD);
+     clock_digits(&ttyclock->remaining, digit);
 
-     if (ttyclock->option.date)
+     /* 2 dot for number separation, dark every other second when blinking */
+     if (ttyclock->option.blink && ttyclock->remaining.seconds % 2 == 0)
+          colon = 2;
+
+     if(ttyclock->option.bold != ttyclock->frame.bold)
      {
-          wbkgdset(ttyclock->datewin, (COLOR_PAIR(2)));
-          mvwprintw(ttyclock->datewin, (DATEWINH / 2), 1, ttyclock->date.datestr);
-          wrefresh(ttyclock->datewin);
+          invalidate_frame();
+          ttyclock->frame.bold = ttyclock->option.bold;
      }
 
-     /* Draw second if the option is enable */
-     if(ttyclock->option.second)
+     /* Draw only the slots that changed since the last frame */
+     nslot = ttyclock->option.second ? FRAMESLOTS : 4;
+     for(i = 0; i < nslot; ++i)
+          if(digit[i] != ttyclock->frame.digit[i])
+               draw_number((ttyclock->frame.digit[i] = digit[i]), 1, 1 + (slot_y[i] - 1) * s);
+
+     if(colon != ttyclock->frame.colon[0])
+          draw_colon(1 + 15 * s, (ttyclock->frame.colon[0] = colon));
+
+     /* Again 2 dot for number separation if the seconds are shown */
+     if(ttyclock->option.second && ttyclock->frame.colon[1] != 1)
+          draw_colon(1 + (NORMFRAMEW - 1) * s, (ttyclock->frame.colon[1] = 1));
+
+     /* Draw the date */
+     if (ttyclock->option.date && !ttyclock->option.ansi)
      {
-          /* Again 2 dot for number separation */
-          wbkgdset(ttyclock->framewin, COLOR_PAIR(1));
-          mvwaddstr(ttyclock->framewin, 2, NORMFRAMEW, "  ");
-          mvwaddstr(ttyclock->framewin, 4, NORMFRAMEW, "  ");
+          if (ttyclock->option.bold)
+               wattron(ttyclock->datewin, A_BOLD);
+          else
+               wattroff(ttyclock->datewin, A_BOLD);
+
+          wbkgdset(ttyclock->datewin, (COLOR_PAIR(2)));
+          mvwprintw(ttyclock->datewin, (DATEWINH / 2), 1, "%s", ttyclock->date.datestr);
+          wnoutrefresh(ttyclock->datewin);
+     }
 
-          /* Draw second numbers */
-          draw_number(ttyclock->date.second[0], 1, 39);
-          draw_number(ttyclock->date.second[1], 1, 46);
+     draw_progress();
+
+     ttyclock->stats.last_cells = ttyclock->stats.cells - cells;
+     ++ttyclock->stats.frames;
+
+     /* One flush per frame */
+     if(ttyclock->option.ansi)
+          ansi_flush();
+     else
+     {
+          /* The screen takes the background of the last window refreshed,
+           * and resizeterm() fills the cells it adds with it */
+          wbkgdset(ttyclock->framewin, COLOR_PAIR(0));
+          wnoutrefresh(ttyclock->framewin);
+          if(ttyclock->barwin)
+               wnoutrefresh(ttyclock->barwin);
+          doupdate();
      }
+     ttyclock->stats.draw_ns += clock_ns(CLOCK_MONOTONIC) - start;
 
      return;
 }
 
 void clock_move(int x, int y, int w, int h){
 
-     /* Erase border for a clean move */
+     if(ttyclock->option.ansi)
+     {
+          ansi_move((ttyclock->geo.x = x), (ttyclock->geo.y = y));
+          ttyclock->geo.h = h;
+          ttyclock->geo.w = w;
+          invalidate_frame();
+          if(ttyclock->option.box)
+               ansi_box(True);
+          return;
+     }
+
+     /* Erase border for a clean move; flushed with the next draw_clock() */
      wbkgdset(ttyclock->framewin, COLOR_PAIR(0));
      wborder(ttyclock->framewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
      werase(ttyclock->framewin);
-     wrefresh(ttyclock->framewin);
+     wnoutrefresh(ttyclock->framewin);
+     invalidate_frame();
 
      if (ttyclock->option.date)
      {
           wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
           wborder(ttyclock->datewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
           werase(ttyclock->datewin);
-          wrefresh(ttyclock->datewin);
+          wnoutrefresh(ttyclock->datewin);
+     }
+     if (ttyclock->barwin)
+     {
+          wattrset(ttyclock->barwin, COLOR_PAIR(0));
+          werase(ttyclock->barwin);
+          wnoutrefresh(ttyclock->barwin);
      }
 
      /* Frame win move */
      mvwin(ttyclock->framewin, (ttyclock->geo.x = x), (ttyclock->geo.y = y));
      wresize(ttyclock->framewin, (ttyclock->geo.h = h), (ttyclock->geo.w = w));
 
+     /* Bar win move, drawn again by the next draw_clock() */
+     if (ttyclock->barwin)
+     {
+          wresize(ttyclock->barwin, 1, MAX(w - 2, 1));
+          mvwin(ttyclock->barwin, bar_row(), y + 1);
+     }
+
      /* Date win move */
      if (ttyclock->option.date)
      {
@@ -334,41 +507,135 @@ void clock_move(int x, int y, int w, int h){
         box(ttyclock->framewin, 0, 0);
      }
 
-     wrefresh(ttyclock->framewin);
-     wrefresh(ttyclock->datewin); 
+     wnoutrefresh(ttyclock->framewin);
+     if (ttyclock->option.date)
+          wnoutrefresh(ttyclock->datewin);
+     return;
+}
+
+/* Move the current terminal's frame by dx rows and dy columns, keeping
+ * what it shows. Unlike clock_move() nothing is erased or redrawn: the
+ * strip the frame leaves is cleared and the terminal shifts the rest,
+ * ncurses scrolling or inserting and deleting characters (see idlok() in
+ * init_windows()) and ansi.c with ansi_shift(). */
+void clock_shift(int dx, int dy){
+     int x = ttyclock->geo.x;
+
+     ttyclock->geo.x += dx;
+     ttyclock->geo.y += dy;
+
+     if(ttyclock->option.ansi)
+     {
+          ansi_shift(dx, dy);
+          return;
+     }
+
+     mvwin(ttyclock->framewin, ttyclock->geo.x, ttyclock->geo.y);
+     if(ttyclock->option.date)
+          mvwin(ttyclock->datewin,
+                ttyclock->geo.x + ttyclock->geo.h - 1,
+                ttyclock->geo.y + (ttyclock->geo.w / 2) - (strlen(ttyclock->date.datestr) / 2) - 1);
+
+     if(ttyclock->barwin)
+          mvwin(ttyclock->barwin, bar_row(), ttyclock->geo.y + 1);
+
+     /* stdscr is never drawn on: refreshing its lines under both places
+      * blanks them, and the windows refreshed after it cover it again */
+     wtouchln(stdscr, MIN(x, ttyclock->geo.x),
+              ttyclock->geo.h + 1 + (ttyclock->option.date ? DATEWINH - 1 : 0)
+              + (ttyclock->barwin ? 1 : 0), True);
+     wnoutrefresh(stdscr);
+     if(ttyclock->option.date)
+          wnoutrefresh(ttyclock->datewin);
+     if(ttyclock->barwin)
+          wnoutrefresh(ttyclock->barwin);
+
      return;
 }
 
-/* Useless but fun :) */
+/* Useless but fun :) A frame of the rebound animation on the current
+ * terminal. Cells being about twice as high as wide, the frame moves two
+ * columns for every row, and never both ways at once: a move along one
+ * axis is what scrolling or inserting a character can do. */
 void clock_rebound(void){
      if(!ttyclock->option.rebound)
           return;
 
      if(ttyclock->geo.x < 1)
           ttyclock->geo.a = 1;
-     if(ttyclock->geo.x > (LINES - ttyclock->geo.h - DATEWINH))
+     if(ttyclock->geo.x > (ttyclock->cur->lines - ttyclock->geo.h - DATEWINH))
           ttyclock->geo.a = -1;
      if(ttyclock->geo.y < 1)
           ttyclock->geo.b = 1;
-     if(ttyclock->geo.y > (COLS - ttyclock->geo.w - 1))
+     if(ttyclock->geo.y > (ttyclock->cur->cols - ttyclock->geo.w - 1))
           ttyclock->geo.b = -1;
 
-     clock_move(ttyclock->geo.x + ttyclock->geo.a,
-                ttyclock->geo.y + ttyclock->geo.b,
-                ttyclock->geo.w,
-                ttyclock->geo.h);
+     if(ttyclock->stats.rebound_frames % 3 == 2)
+          clock_shift(ttyclock->geo.a, 0);
+     else
+          clock_shift(0, ttyclock->geo.b);
 
      return;
 }
 
 void set_second(void){
-     int new_w = (((ttyclock->option.second = !ttyclock->option.second)) ? SECFRAMEW : NORMFRAMEW);
+     ttyclock->option.second = !ttyclock->option.second;
+     apply_second();
+
+     return;
+}
+
+/* Resize the current terminal's frame to match option.second */
+void apply_second(void){
+     int new_w = (ttyclock->option.second ? SECFRAMEW : NORMFRAMEW);
      int y_adj;
 
-     for(y_adj = 0; (ttyclock->geo.y - y_adj) > (COLS - new_w - 1); ++y_adj);
+     /* The wider frame may need a smaller scale */
+     ttyclock->geo.scale = fit_scale(new_w);
+     new_w = FRAMEW(new_w, ttyclock->geo.scale);
+
+     for(y_adj = 0; (ttyclock->geo.y - y_adj) > (ttyclock->cur->cols - new_w - 1); ++y_adj);
+
+     clock_move(ttyclock->geo.x, (ttyclock->geo.y - y_adj), new_w, FRAMEH(ttyclock->geo.scale));
 
-     clock_move(ttyclock->geo.x, (ttyclock->geo.y - y_adj), new_w, ttyclock->geo.h);
+     set_center(ttyclock->option.center);
+
+     return;
+}
 
+/* Fit the current terminal's frame to its new size. The windows are only
+ * moved and resized and the countdown is left alone; the next draw_terms()
+ * repaints the screen once. */
+void apply_resize(void){
+     int w = (ttyclock->option.second ? SECFRAMEW : NORMFRAMEW);
+     int x, y, h;
+
+     ++ttyclock->stats.resizes;
+     ttyclock->geo.scale = fit_scale(w);
+     w = FRAMEW(w, ttyclock->geo.scale);
+     h = FRAMEH(ttyclock->geo.scale);
+
+     /* Stay put if the frame still fits there */
+     x = MAX(MIN(ttyclock->geo.x, ttyclock->cur->lines - h), 0);
+     y = MAX(MIN(ttyclock->geo.y, ttyclock->cur->cols - w), 0);
+
+     /* What the terminal shows after a resize is anyone's guess (reflowed
+      * lines, a cleared pane), so the whole screen is redrawn */
+     if(ttyclock->option.ansi)
+     {
+          ttyclock->geo.x = x;
+          ttyclock->geo.y = y;
+          ttyclock->geo.w = w;
+          ttyclock->geo.h = h;
+          ansi_init();
+          ansi_box(ttyclock->option.box);
+          invalidate_frame();
+     }
+     else
+     {
+          clock_move(x, y, w, h);
+          clearok(curscr, True);
+     }
      set_center(ttyclock->option.center);
 
      return;
@@ -377,10 +644,14 @@ void set_second(void){
 void set_center(Bool b){
      if((ttyclock->option.center = b))
      {
-          ttyclock->option.rebound = False;
+          if(ttyclock->option.rebound)
+          {
+               ttyclock->option.rebound = False;
+               arm_rebound();
+          }
 
-          clock_move((LINES / 2 - (ttyclock->geo.h / 2)),
-                     (COLS  / 2 - (ttyclock->geo.w / 2)),
+          clock_move((ttyclock->cur->lines / 2 - (ttyclock->geo.h / 2)),
+                     (ttyclock->cur->cols  / 2 - (ttyclock->geo.w / 2)),
                      ttyclock->geo.w,
                      ttyclock->geo.h);
      }
@@ -391,6 +662,12 @@ void set_center(Bool b){
 void set_box(Bool b){
      ttyclock->option.box = b;
 
+     if(ttyclock->option.ansi)
+     {
+          ansi_box(b);
+          return;
+     }
+
      wbkgdset(ttyclock->framewin, COLOR_PAIR(0));
      wbkgdset(ttyclock->datewin, COLOR_PAIR(0));
 
@@ -405,267 +682,593 @@ void set_box(Bool b){
          wborder(ttyclock->datewin, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
      }
 
-     wrefresh(ttyclock->datewin);
-     wrefresh(ttyclock->framewin);
+     wnoutrefresh(ttyclock->datewin);
+     wnoutrefresh(ttyclock->framewin);
 }
 
+/* The current terminal was iconified, or shown again: with nothing left
+ * on screen, tick only for the end of the phase */
+static void set_hidden(Bool hidden){
+     if(ttyclock->cur->hidden == hidden)
+          return;
+
+     ttyclock->cur->hidden = hidden;
+     if(!hidden)
+          update_hour();
+     arm_timer();
+     arm_rebound();
+
+     return;
+}
+
+/* Handle every key ncurses has buffered; called whenever the tty is readable */
 void key_event(void){
      int i, c;
 
-     struct timespec length = { ttyclock->option.delay, ttyclock->option.nsdelay };
-     
-     if (ttyclock->option.screensaver)
+     while((c = ttyclock->option.ansi ? ansi_getch() : wgetch(stdscr)) != ERR)
      {
-          c = wgetch(stdscr);
-          if(c != ERR && ttyclock->option.noquit == False)
+          ++ttyclock->stats.keys;
+          if (ttyclock->option.screensaver)
           {
-               ttyclock->running = False;
+               if(ttyclock->option.noquit == False)
+               {
+                    ttyclock->running = False;
+                    return;
+               }
+               for(i = 0; i < 8; ++i)
+                    if(c == (i + '0'))
+                         /* Applied to every terminal by term_sync() */
+                         ttyclock->option.color = i;
+               continue;
           }
-          else
+          if(split_active() && split_ignores(c))
+               continue;
+
+          switch(c)
           {
-               nanosleep(&length, NULL);
+          case KEY_UP:
+          case 'k':
+          case 'K':
+               if(ttyclock->geo.x >= 1
+                  && !ttyclock->option.center)
+                    clock_move(ttyclock->geo.x - 1, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
+               break;
+
+          case KEY_DOWN:
+          case 'j':
+          case 'J':
+               if(ttyclock->geo.x <= (ttyclock->cur->lines - ttyclock->geo.h - DATEWINH)
+                  && !ttyclock->option.center)
+                    clock_move(ttyclock->geo.x + 1, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
+               break;
+
+          case KEY_LEFT:
+          case 'h':
+          case 'H':
+               if(ttyclock->geo.y >= 1
+                  && !ttyclock->option.center)
+                    clock_move(ttyclock->geo.x, ttyclock->geo.y - 1, ttyclock->geo.w, ttyclock->geo.h);
+               break;
+
+          case KEY_RIGHT:
+          case 'l':
+          case 'L':
+               if(ttyclock->geo.y <= (ttyclock->cur->cols - ttyclock->geo.w - 1)
+                  && !ttyclock->option.center)
+                    clock_move(ttyclock->geo.x, ttyclock->geo.y + 1, ttyclock->geo.w, ttyclock->geo.h);
+               break;
+
+          case 'q':
+          case 'Q':
+               if (ttyclock->option.noquit == False)
+                    ttyclock->running = False;
+               break;
+
+          case 's':
+          case 'S':
+               set_second();
+               break;
+
+          case 't':
+          case 'T':
+               ttyclock->option.twelve = !ttyclock->option.twelve;
+               /* Set the new ttyclock->date.datestr to resize date window */
+               update_hour();
+               clock_move(ttyclock->geo.x, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
+               break;
+
+          case 'c':
+          case 'C':
+               set_center(!ttyclock->option.center);
+               break;
+
+          case 'b':
+          case 'B':
+               ttyclock->option.bold = !ttyclock->option.bold;
+               break;
+
+          case 'r':
+          case 'R':
+               ttyclock->option.rebound = !ttyclock->option.rebound;
+               if(ttyclock->option.rebound && ttyclock->option.center)
+                    ttyclock->option.center = False;
+               arm_rebound();
+               break;
+
+          case 'x':
+          case 'X':
+               set_box(!ttyclock->option.box);
+               break;
+
+          case 'f':
+          case 'F':
+               /* Applied to every terminal by term_sync() */
+               if(font_loaded())
+                    ttyclock->option.font = !ttyclock->option.font;
+               break;
+
+          case 'p':
+          case 'P':
+               toggle_pause();
+               break;
+
+          case 'm':
+          case 'M':
+               ttyclock->option.minutes = !ttyclock->option.minutes;
+               arm_timer();
+               break;
+
+          case KEY_FOCUSOUT:
+               /* Maybe iconified: ask, the answer comes as a key */
+               term_report(ttyclock->cur, "\033[11t");
+               break;
+
+          case KEY_ICONIFIED:
+          case KEY_SHOWN:
+          case KEY_FOCUSIN:
+               set_hidden(c == KEY_ICONIFIED);
+               break;
+
+          default:
                for(i = 0; i < 8; ++i)
                     if(c == (i + '0'))
-                    {
+                         /* Applied to every terminal by term_sync() */
                          ttyclock->option.color = i;
-                         init_pair(1, ttyclock->bg, i);
-                         init_pair(2, i, ttyclock->bg);
-                    }
+               break;
           }
+     }
+
+     return;
+}
+
+/* Whether anything shows the timer: a --stream, or a terminal that is
+ * neither gone nor iconified */
+Bool on_screen(void){
+     int i;
+
+     if(ttyclock->option.stream)
+          return True;
+     for(i = 0; i < ttyclock->nterm; ++i)
+          if(!ttyclock->term[i].dead && !ttyclock->term[i].hidden)
+               return True;
+
+     return False;
+}
+
+/* How often what is shown can change: every second for MM:SS, a blinking
+ * colon or a --stream line, every minute with --minutes. 0 with nothing
+ * on screen: only the end of the phase matters then. */
+int64_t tick_unit(void){
+     if(!on_screen())
+          return 0;
+     if(ttyclock->option.minutes && !ttyclock->option.blink && !ttyclock->option.stream)
+          return 60 * NSEC_PER_SEC;
+
+     return NSEC_PER_SEC;
+}
+
+/* When, on the countdown clock, what is shown next changes */
+int64_t tick_next(void){
+     return countdown_next_tick(&ttyclock->countdown, tick_unit());
+}
+
+static void soft_event(int fd, short revents, void *arg);
+
+/* The next minute of --minutes, by the loop's soft wakeup, if it comes
+ * before the end of the phase */
+static void arm_soft(void){
+     const countdown_t *cd = &ttyclock->countdown;
+     int64_t next = tick_next();
+
+     loop_soft(0, NULL);
+     if(next && next < cd->deadline)
+          loop_soft(clock_ns(CLOCK_MONOTONIC) + next - clock_ns(cd->clock), soft_event);
+
+     return;
+}
+
+static void soft_event(int fd, short revents, void *arg){
+     update_hour();
+     draw_terms();
+     journal_sync();
+     arm_soft();
+
+     return;
+}
+
+/* Arm the tick timer. Ticking every second, the first expiry is when the
+ * displayed seconds next change, then every delay + nsdelay; the expiries
+ * are absolute on the countdown clock, so they stay on the second
+ * boundaries without accumulating drift, and a zero delay keeps the old
+ * "redraw as fast as possible". Slower, the timer only waits for the end
+ * of the phase and arm_soft() for the minutes on the way, under a
+ * generous timer slack: a timerfd takes none. */
+void arm_timer(void){
+     static int slack = -1;
+     const countdown_t *cd = &ttyclock->countdown;
+     struct itimerspec its;
+     int64_t unit = tick_unit(), next = tick_next();
+
+     /* The countdown changed: tell the status bars and the viewers, pace
+      * the bar and the other --split timers */
+     status_publish();
+     share_publish();
+     arm_progress();
+     arm_split();
+
+     /* Nothing to wait for: sim_tick() draws the ticks */
+     if(cd->clock == CLOCK_VIRTUAL)
           return;
+
+     if(slack != (unit != NSEC_PER_SEC))
+     {
+          /* 0 puts the default back */
+          slack = (unit != NSEC_PER_SEC);
+          prctl(PR_SET_TIMERSLACK, slack ? TICKSLACK : 0);
      }
-     
+     arm_soft();
+
+     memset(&its, 0, sizeof(its));
+     ttyclock->tick_interval = 0;
 
-     switch(c = wgetch(stdscr))
+     /* Paused: disarm */
+     if(!next)
      {
-     case KEY_UP:
-     case 'k':
-     case 'K':
-          if(ttyclock->geo.x >= 1
-             && !ttyclock->option.center)
-               clock_move(ttyclock->geo.x - 1, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
-          break;
+          ttyclock->tick_due = 0;
+          timerfd_settime(ttyclock->timerfd, 0, &its, NULL);
+          return;
+     }
 
-     case KEY_DOWN:
-     case 'j':
-     case 'J':
-          if(ttyclock->geo.x <= (LINES - ttyclock->geo.h - DATEWINH)
-             && !ttyclock->option.center)
-               clock_move(ttyclock->geo.x + 1, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
-          break;
+     if(unit == NSEC_PER_SEC)
+     {
+          its.it_interval.tv_sec = ttyclock->option.delay;
+          its.it_interval.tv_nsec = ttyclock->option.nsdelay;
+          if(!its.it_interval.tv_sec && !its.it_interval.tv_nsec)
+               its.it_interval.tv_nsec = 1;
+          ttyclock->tick_interval = its.it_interval.tv_sec * NSEC_PER_SEC + its.it_interval.tv_nsec;
+     }
+     else
+          next = cd->deadline;
+     its.it_value.tv_sec = next / NSEC_PER_SEC;
+     its.it_value.tv_nsec = next % NSEC_PER_SEC;
+     ttyclock->tick_due = next;
 
-     case KEY_LEFT:
-     case 'h':
-     case 'H':
-          if(ttyclock->geo.y >= 1
-             && !ttyclock->option.center)
-               clock_move(ttyclock->geo.x, ttyclock->geo.y - 1, ttyclock->geo.w, ttyclock->geo.h);
-          break;
+     timerfd_settime(ttyclock->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
 
-     case KEY_RIGHT:
-     case 'l':
-     case 'L':
-          if(ttyclock->geo.y <= (COLS - ttyclock->geo.w - 1)
-             && !ttyclock->option.center)
-               clock_move(ttyclock->geo.x, ttyclock->geo.y + 1, ttyclock->geo.w, ttyclock->geo.h);
-          break;
+     return;
+}
 
-     case 'q':
-     case 'Q':
-          if (ttyclock->option.noquit == False)
-		  ttyclock->running = False;
-          break;
+/* Bring the current terminal in line with options changed elsewhere,
+ * e.g. by a key pressed on another terminal */
+void term_sync(void){
+     term_t *t = ttyclock->cur;
 
-     case 's':
-     case 'S':
-          set_second();
-          break;
+     if(t->applied.color != ttyclock->option.color)
+     {
+          if(ttyclock->option.ansi)
+               ansi_invalidate();
+          else
+          {
+               init_pair(1, ttyclock->bg, ttyclock->option.color);
+               init_pair(2, ttyclock->option.color, ttyclock->bg);
+          }
+          t->applied.color = ttyclock->option.color;
+     }
+     if(t->applied.font != ttyclock->option.font)
+     {
+          invalidate_frame();
+          t->applied.font = ttyclock->option.font;
+     }
+     if(t->applied.second != ttyclock->option.second)
+     {
+          apply_second();
+          t->applied.second = ttyclock->option.second;
+     }
+     if(t->applied.center != ttyclock->option.center)
+     {
+          set_center(ttyclock->option.center);
+          t->applied.center = ttyclock->option.center;
+     }
+     if(t->applied.box != ttyclock->option.box)
+     {
+          set_box(ttyclock->option.box);
+          t->applied.box = ttyclock->option.box;
+     }
 
-     case 't':
-     case 'T':
-          ttyclock->option.twelve = !ttyclock->option.twelve;
-          /* Set the new ttyclock->date.datestr to resize date window */
-          update_hour();
-          clock_move(ttyclock->geo.x, ttyclock->geo.y, ttyclock->geo.w, ttyclock->geo.h);
-          break;
+     return;
+}
 
-     case 'c':
-     case 'C':
-          set_center(!ttyclock->option.center);
-          break;
+/* Render the frame computed by update_hour() on every terminal, or as a
+ * line with --stream. A tty still busy with earlier frames is skipped:
+ * its frame state is left as it was, so the next frame it takes repaints
+ * whatever it missed. */
+void draw_terms(void){
+     term_t *t;
+     int i, alive = 0;
 
-     case 'b':
-     case 'B':
-          ttyclock->option.bold = !ttyclock->option.bold;
-          break;
+     /* The viewers draw for themselves */
+     if(share_serving())
+          return;
 
-     case 'r':
-     case 'R':
-          ttyclock->option.rebound = !ttyclock->option.rebound;
-          if(ttyclock->option.rebound && ttyclock->option.center)
-               ttyclock->option.center = False;
-          break;
+     if(ttyclock->option.stream)
+     {
+          stream_frame();
+          return;
+     }
+     if(split_active())
+     {
+          split_frame();
+          return;
+     }
 
-     case 'x':
-     case 'X':
-          set_box(!ttyclock->option.box);
-          break;
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          if(t->dead)
+               continue;
+          ++alive;
+
+          /* Iconified: drawn again once shown, from what it last got */
+          if(t->hidden)
+               continue;
+          if(term_backlog(t) > TERMBACKLOG)
+          {
+               ++t->stats.dropped;
+               continue;
+          }
 
-     default:
-          nanosleep(&length, NULL);
-          for(i = 0; i < 8; ++i)
-               if(c == (i + '0'))
-               {
-                    ttyclock->option.color = i;
-                    init_pair(1, ttyclock->bg, i);
-                    init_pair(2, i, ttyclock->bg);
-               }
-          break;
+          term_select(t);
+          term_sync();
+          draw_clock();
+          ++t->stats.frames;
+          term_flush(t);
+     }
+
+     if(!alive)
+          ttyclock->running = False;
+
+     return;
+}
+
+static void tick_event(int fd, short revents, void *arg){
+     uint64_t expirations;
+
+     if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          return;
+
+     /* Lateness against the last of the expirations */
+     if(ttyclock->tick_due)
+     {
+          ttyclock->tick_due += (expirations - 1) * ttyclock->tick_interval;
+          metrics_late(clock_ns(ttyclock->countdown.clock) - ttyclock->tick_due);
+          ttyclock->tick_due += ttyclock->tick_interval;
      }
 
+     update_hour();
+     draw_terms();
+     journal_sync();
+
      return;
 }
 
-void print_usage(){
-   printf("usage : tty-clock [-ivcbrahBxn] [-C [0-7]] [-d delay] [-a nsdelay] [-T tty] [short | long]\n"
-              "    -x            Show box                                       \n"
-              "    -c            Set the timer at the center of the terminal    \n"
-              "    -C [0-7]      Set the clock color                            \n"
-              "    -b            Use bold colors                                \n"
-              "    -T tty        Display the timer on the specified terminal    \n"
-              "    -r            Do rebound the timer                           \n"
-              "    -n            Don't quit on keypress                         \n"
-              "    -v            Show tty-pomodoro version                      \n"
-              "    -i            Show some info about tty-pomodoro              \n"
-              "    -h            Show this page                                 \n"
-              "    -B            Enable blinking colon                          \n"
-              "    -d delay      Set the delay between two redraws of the timer . Default 1s. \n"
-              "    -a nsdelay    Additional delay between two redraws in nanoseconds. Default 0ns.\n"
-              "    short         Take a five minute break                       \n"
-              "    long          Take a ten minute break                        \n");
+/* Pace the rebound animation at option.fps, apart from the ticks: it
+ * only runs while rebound is on */
+void arm_rebound(void){
+     struct itimerspec its;
+
+     memset(&its, 0, sizeof(its));
+     if(ttyclock->option.rebound && on_screen() && !split_active())
+     {
+          its.it_interval.tv_nsec = NSEC_PER_SEC / ttyclock->option.fps;
+          its.it_value = its.it_interval;
+     }
+     timerfd_settime(ttyclock->animfd, 0, &its, NULL);
+
+     return;
+}
+
+/* Move the frame a step on every terminal. Only the frame moves, so a
+ * frame costs the strip it leaves and the terminal's shift, not a repaint;
+ * frames missed while late are not caught up. */
+void rebound_frame(void){
+     int64_t start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+     unsigned long bytes;
+     term_t *t;
+     int i;
+
+     for(i = 0; i < ttyclock->nterm; ++i)
+     {
+          t = &ttyclock->term[i];
+          if(t->dead || t->hidden)
+               continue;
+          if(term_backlog(t) > TERMBACKLOG)
+          {
+               ++t->stats.dropped;
+               continue;
+          }
+
+          term_select(t);
+          bytes = t->stats.bytes;
+          clock_rebound();
+          if(ttyclock->option.ansi)
+               ansi_flush();
+          else
+          {
+               wnoutrefresh(ttyclock->framewin);
+               doupdate();
+          }
+          term_flush(t);
+          ttyclock->stats.rebound_bytes += t->stats.bytes - bytes;
+     }
+     ++ttyclock->stats.rebound_frames;
+     ttyclock->stats.rebound_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - start;
+
+     return;
 }
 
-int main(int argc, char **argv){
-     int c;
+static void rebound_event(int fd, short revents, void *arg){
+     uint64_t expirations;
+
+     if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          return;
+
+     rebound_frame();
 
-     /* Alloc ttyclock */
-     ttyclock = malloc(sizeof(ttyclock_t));
-     assert(ttyclock != NULL);
-     memset(ttyclock, 0, sizeof(ttyclock_t));
+     return;
+}
 
-     ttyclock->option.date = True;
+static void signal_event(int fd, short revents, void *arg){
+     struct signalfd_siginfo si;
 
-     /* Date format */
-     ttyclock->option.format = malloc(sizeof(char) * 100);
-     /* Default date format */
-     strncpy(ttyclock->option.format, "%F", 100);
-     /* Default color */
-     ttyclock->option.color = COLOR_RED; 
-     /* Default delay */
-     ttyclock->option.delay = 1; /* 1FPS */
-     ttyclock->option.nsdelay = 0; /* -0FPS */
-     ttyclock->option.blink = False;
+     while(read(fd, &si, sizeof(si)) == sizeof(si))
+          signal_handler(si.ssi_signo);
 
-     /* Never show seconds */
-     ttyclock->option.second = False;
+     if(ttyclock->running)
+          draw_terms();
 
-     /* Hide the date */
-     ttyclock->option.date = False;
+     return;
+}
 
-     atexit(cleanup);
+/* A burst of SIGWINCH is over: fit every terminal to its size */
+static void resize_event(int fd, short revents, void *arg){
+     uint64_t expirations;
+     int i;
 
-     while ((c = getopt(argc, argv, "ivcbrhBxnC:d:T:a:")) != -1){
-          switch(c)
+     if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+          return;
+
+     for(i = 0; i < ttyclock->nterm; ++i)
+          if(!ttyclock->term[i].dead)
           {
-          case 'h':
-          default:
-               print_usage();
-               exit(EXIT_SUCCESS);
-               break;
-          case 'i':
-               puts("TTY-Clock 2 © by Martin Duquesnoy (xorg62@gmail.com), Grey (grey@greytheory.net)");
-               exit(EXIT_SUCCESS);
-               break;
-          case 'v':
-               puts("TTY-Clock 2 © devel version");
-               exit(EXIT_SUCCESS);
-               break;
-          case 'c':
-               ttyclock->option.center = True;
-               break;
-          case 'b':
-               ttyclock->option.bold = True;
-               break;
-          case 'C':
-               if(atoi(optarg) >= 0 && atoi(optarg) < 8)
-                    ttyclock->option.color = atoi(optarg);
-               break;
-          case 'r':
-               ttyclock->option.rebound = True;
-               break;
-          case 'd':
-               if(atol(optarg) >= 0 && atol(optarg) < 100)
-                    ttyclock->option.delay = atol(optarg);
-               break;
-          case 'B':
-               ttyclock->option.blink = True;
-               break;
-          case 'a':
-               if(atol(optarg) >= 0 && atol(optarg) < 1000000000)
-                    ttyclock->option.nsdelay = atol(optarg);
-                break;
-          case 'x':
-               ttyclock->option.box = True;
-               break;
-	  case 'T': {
-	       struct stat sbuf;
-	       if (stat(optarg, &sbuf) == -1) {
-		       fprintf(stderr, "tty-clock: error: couldn't stat '%s': %s.\n",
-				       optarg, strerror(errno));
-		       exit(EXIT_FAILURE);
-	       } else if (!S_ISCHR(sbuf.st_mode)) {
-		       fprintf(stderr, "tty-clock: error: '%s' doesn't appear to be a character device.\n",
-				       optarg);
-		       exit(EXIT_FAILURE);
-	       } else {
-	       		if (ttyclock->tty)
-				free(ttyclock->tty);
-			ttyclock->tty = strdup(optarg);
-	       }}
-	       break;
-	  case 'n':
-	       ttyclock->option.noquit = True;
-	       break;
+               term_select(&ttyclock->term[i]);
+               if(term_resize(ttyclock->cur))
+               {
+                    if(split_active())
+                         split_layout();
+                    else
+                         apply_resize();
+               }
+          }
+     /* The bars may be wider or narrower */
+     arm_progress();
+
+     if(ttyclock->running)
+          draw_terms();
+
+     return;
+}
+
+static void tty_event(int fd, short revents, void *arg){
+     term_t *t = arg;
+
+     /* A hangup comes with POLLIN too, and nothing to read */
+     if(revents & (POLLHUP | POLLERR))
+          term_lost(t);
+     else
+     {
+          if(revents & POLLOUT)
+               term_flush(t);
+          if(revents & POLLIN)
+          {
+               term_select(t);
+               key_event();
+               if(ttyclock->running)
+                    draw_terms();
           }
      }
 
-     /* Set the default minutes to 25 */
-     start_minutes = DEFAULT_TIME;
+     return;
+}
 
-     /* Check if short or long break */
-     if (optind < argc){
-        char *argument = argv[optind];
-        if (!strcmp(argument, "short")){
-            start_minutes = SHORT_BREAK;
-        }else if (!strcmp(argument, "long")){
-            start_minutes = LONG_BREAK;
-        }else{
-            printf("Command not recognized\n");
-            print_usage();
-            exit(EXIT_FAILURE);
-        }
+/* Route SIGWINCH/SIGINT/SIGTERM/SIGUSR1 through a signalfd and the ticks
+ * through a timerfd, so that nothing but SIGSEGV runs in signal context. */
+void init_events(void){
+     struct sigaction sig;
+     sigset_t mask;
+
+     sigemptyset(&mask);
+     sigaddset(&mask, SIGWINCH);
+     sigaddset(&mask, SIGTERM);
+     sigaddset(&mask, SIGINT);
+     sigaddset(&mask, SIGUSR1);
+     sigprocmask(SIG_BLOCK, &mask, NULL);
+
+     ttyclock->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+     ttyclock->timerfd = timerfd_create(ttyclock->countdown.clock == CLOCK_VIRTUAL
+                                        ? CLOCK_MONOTONIC : ttyclock->countdown.clock,
+                                        TFD_NONBLOCK | TFD_CLOEXEC);
+     ttyclock->resizefd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+     ttyclock->animfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+     if(ttyclock->sigfd < 0 || ttyclock->timerfd < 0 || ttyclock->resizefd < 0
+        || ttyclock->animfd < 0)
+     {
+          fprintf(stderr, "tty-clock: error: couldn't set up event sources: %s.\n",
+                  strerror(errno));
+          exit(EXIT_FAILURE);
      }
 
-     init();
-     attron(A_BLINK);
-     while(ttyclock->running){
-          clock_rebound();
-          update_hour();
-          draw_clock();
-          key_event();
+     loop_add(ttyclock->sigfd, POLLIN, signal_event, NULL);
+     loop_add(ttyclock->timerfd, POLLIN, tick_event, NULL);
+     loop_add(ttyclock->resizefd, POLLIN, resize_event, NULL);
+     loop_add(ttyclock->animfd, POLLIN, rebound_event, NULL);
+
+     memset(&sig, 0, sizeof(sig));
+     sig.sa_handler = signal_handler;
+     sigaction(SIGSEGV, &sig, NULL);
+
+     return;
+}
+
+/* Pause or resume, locally or through the daemon or timer we are
+ * attached to */
+void toggle_pause(void){
+     if(client_attached())
+     {
+          client_pause(!ttyclock->countdown.paused);
+          return;
+     }
+     if(share_viewing())
+     {
+          share_pause();
+          return;
      }
 
-     endwin();
+     if(ttyclock->countdown.paused)
+     {
+          /* From its full length, e.g. a --cycle phase waiting for 'p' */
+          journal_append(ttyclock->countdown.left == ttyclock->countdown.length
+                         ? JOURNAL_START : JOURNAL_RESUME);
+          countdown_resume(&ttyclock->countdown);
+     }
+     else
+     {
+          countdown_pause(&ttyclock->countdown);
+          journal_append(JOURNAL_PAUSE);
+     }
+     checkpoint_save();
+     schedule_plan();
+     arm_timer();
+     update_hour();
 
-     return 0;
+     return;
 }
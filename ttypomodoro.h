@@ -33,10 +33,23 @@
 #ifndef TTYCLOCK_H_INCLUDED
 #define TTYCLOCK_H_INCLUDED
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
@@ -44,11 +57,49 @@
 #include <ncurses.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <ctype.h>
 
 /* Macro */
 #define NORMFRAMEW 35
 #define SECFRAMEW  54
 #define DATEWINH   3
+#define FRAMESLOTS 6
+#define MAXTERMS   16
+#define TERMBUF    4096
+#define TERMBACKLOG 4096
+/* SIGWINCHs within this many ms of the first are handled as one resize */
+#define RESIZEMS   50
+/* --stream line format unless given */
+#define STREAM_FORMAT "%p %t %S"
+/* Rebound animation frame rate: default and largest (--fps) */
+#define REBOUND_FPS 30
+#define MAXFPS      120
+/* Largest digit scale (see font.c) */
+#define MAXSCALE   16
+/* Glyph size, glyphs per font and most spans a glyph is drawn with */
+#define FONTW      3
+#define FONTH      5
+#define FONTGLYPHS 128
+#define FONTSPANS  (FONTW * FONTH * MAXSCALE)
+#define FONT_MAGIC "TPF1"
+/* Raw ANSI backend: largest scale, cell buffer and output buffer sizes */
+#define ANSISCALE   3
+#define ANSIROWS    (FRAMEH(ANSISCALE) + 1)
+#define ANSICOLS    FRAMEW(SECFRAMEW, ANSISCALE)
+#define ANSIBUF     4096
+/* Cell attributes: colour pair and blink */
+#define ANSIATTRS   8
+/* Most updates of the --progress bar per second */
+#define PROGRESS_HZ 2
+/* Focus events and window state replies, read as keys (see key_event()) */
+#define KEY_FOCUSIN   (KEY_MAX + 1)
+#define KEY_FOCUSOUT  (KEY_MAX + 2)
+#define KEY_SHOWN     (KEY_MAX + 3)
+#define KEY_ICONIFIED (KEY_MAX + 4)
+/* Timer slack while the ticks are a minute or more apart (see arm_timer()) */
+#define TICKSLACK   NSEC_PER_SEC
+/* Tick lateness histogram buckets, besides +Inf (see metrics.c) */
+#define METRICS_BUCKETS 9
 #define AMSIGN     " [AM]"
 #define PMSIGN     " [PM]"
 
@@ -56,9 +107,272 @@
 #define DEFAULT_TIME 25
 #define SHORT_BREAK 5
 #define LONG_BREAK 10
+/* Phases in an expanded --cycle sequence, and planned ahead */
+#define SCHEDULE_MAX   64
+#define SCHEDULE_AHEAD 10
+/* --notify hooks, their default timeout, and how long an exit waits for
+ * the last phase's hooks to be started */
+#define NOTIFY_HOOKS   8
+#define NOTIFY_TIMEOUT (10 * NSEC_PER_SEC)
+#define NOTIFY_DRAIN   NSEC_PER_SEC
+
+#define NSEC_PER_SEC 1000000000LL
+/* Countdown clock moved by hand (--clock virtual); no kernel clock id */
+#define CLOCK_VIRTUAL ((clockid_t)0x7fff)
+
+/* Frame size at a digit scale, from its size at scale 1 */
+#define FRAMEW(w, scale) (2 + ((w) - 2) * (scale))
+#define FRAMEH(scale)    (2 + 5 * (scale))
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* Long-only options */
+enum
+{
+     OPT_DAEMON = 256,
+     OPT_SOCKET,
+     OPT_TIMER,
+     OPT_JOURNAL,
+     OPT_FROM,
+     OPT_TO,
+     OPT_FORMAT,
+     OPT_RESUME,
+     OPT_ANSI,
+     OPT_METRICS,
+     OPT_SCALE,
+     OPT_CYCLE,
+     OPT_AUTO,
+     OPT_SCHEDULE,
+     OPT_BELL,
+     OPT_NOTIFY,
+     OPT_NOTIFY_TIMEOUT,
+     OPT_FPS,
+     OPT_QUERY,
+     OPT_STREAM,
+     OPT_CLOCK,
+     OPT_SCRIPT,
+     OPT_FONT,
+     OPT_DUMP_FONT,
+     OPT_PROGRESS,
+     OPT_MINUTES,
+     OPT_CONFIG,
+     OPT_SPLIT
+};
+
+/* Kind of countdown */
+typedef enum { PHASE_WORK, PHASE_SHORT, PHASE_LONG } phase_t;
+
+/* Session journal record (see journal.c) */
+enum
+{
+     JOURNAL_START = 1,
+     JOURNAL_PAUSE,
+     JOURNAL_RESUME,
+     JOURNAL_INTERRUPT,
+     JOURNAL_COMPLETE
+};
+
+typedef struct
+{
+     /* CRC-32 of the 28 bytes that follow */
+     uint32_t crc;
+     uint16_t type;
+     uint16_t phase;
+     /* Wall clock, ns since the epoch */
+     int64_t time;
+     /* Phase length and time counted down so far, in seconds */
+     uint32_t length;
+     uint32_t elapsed;
+     char tag[8];
+} journal_rec_t;
+
+/* A journal mapped for reading */
+typedef struct
+{
+     const journal_rec_t *rec;
+     size_t n;
+     void *map;
+     size_t size;
+} journal_map_t;
 
 typedef enum { False, True } Bool;
 
+/* Countdown towards an absolute deadline on a monotonic clock */
+typedef struct
+{
+     clockid_t clock;
+     int64_t deadline;
+     int64_t length;
+     Bool paused;
+     int64_t left;
+} countdown_t;
+
+/* A planned phase of the --cycle sequence (see schedule.c) */
+typedef struct
+{
+     phase_t phase;
+     int64_t length;
+     /* On the countdown clock */
+     int64_t start, end;
+     /* False for times that a pause or a wait for 'p' can still move */
+     Bool firm;
+} schedule_t;
+
+/* Notification counters, kept by the worker (see notify.c) */
+typedef struct
+{
+     /* Events queued, and dropped on a full queue */
+     unsigned long queued, dropped;
+     /* Hooks started, skipped (still running or rate limited), failed to
+      * start or exited non-zero, and killed at their timeout */
+     unsigned long spawned, skipped, failed, timedout;
+     /* From queueing to posix_spawn(), total and worst, ns */
+     int64_t latency_ns, latency_max_ns;
+} notify_stats_t;
+
+/* Timer state published for status bars (see status.c), in the shared
+ * memory segment /tty-pomodoro-<uid>. Read it with status_read(): seq is
+ * odd while it is being written. */
+#define STATUS_MAGIC 0x74747970
+#define STATUS_NONE  0xFFFF
+typedef struct
+{
+     uint32_t magic;
+     uint32_t seq;
+     int32_t pid;
+     /* Clock of the deadline */
+     int32_t clock;
+     uint16_t phase;
+     uint16_t paused;
+     /* Position in the --cycle sequence, and the phase after this one or
+      * STATUS_NONE */
+     uint32_t cycle;
+     uint16_t next;
+     char tag[8];
+     /* Deadline on clock, time left as of the write and phase length, ns */
+     int64_t deadline, left, length;
+     /* Wall clock of the deadline, ns since the epoch, 0 when paused */
+     int64_t end;
+} status_t;
+
+/* Remaining time as displayed, rounded up to the second */
+typedef struct
+{
+     unsigned int minutes, seconds;
+     unsigned int digit[4];
+     int64_t ns;
+     Bool expired;
+} remaining_t;
+
+/* Clock geometry */
+typedef struct
+{
+     int x, y, w, h;
+     /* For rebound use (see clock_rebound())*/
+     int a, b;
+     /* Digit scale */
+     int scale;
+} geo_t;
+
+/* A run of same coloured cells on one row of a glyph (see font.c) */
+typedef struct
+{
+     unsigned short x, y, w;
+     unsigned char pair;
+} span_t;
+
+/* Glyph atlas, as mapped from a --font file (see font.c) */
+typedef struct
+{
+     char magic[4];
+     uint8_t width, height;
+     uint16_t pad;
+     uint32_t glyph[FONTGLYPHS];
+} font_t;
+
+/* What the last draw_clock() left on screen (-1: unknown) */
+typedef struct
+{
+     int digit[FRAMESLOTS];
+     int colon[2];
+     Bool bold;
+     /* --progress bar fill, in eighths of a cell */
+     int bar;
+} frame_t;
+
+/* Raw ANSI backend state of a terminal (see ansi.c). Cells cover the
+ * frame and the --progress row under it: bits 0-1 colour pair, bit 2
+ * blink, bits 3-6 glyph. */
+typedef struct
+{
+     /* What the frame should show, and what the terminal shows */
+     unsigned char back[ANSIROWS][ANSICOLS];
+     unsigned char front[ANSIROWS][ANSICOLS];
+     /* Frame origin on screen, now and as of the last flush, and the
+      * size it had then */
+     int x, y, ox, oy, oh, ow;
+     /* Cursor, attributes and charset on the terminal, -1: unknown */
+     int cx, cy, attr, acs;
+     /* SGR from attributes [from] (ANSIATTRS: unknown) to [to] */
+     char sgr[ANSIATTRS + 1][ANSIATTRS][16];
+     unsigned char sgrlen[ANSIATTRS + 1][ANSIATTRS];
+     int fd;
+     /* Output of the frame being rendered */
+     char out[ANSIBUF];
+     size_t len;
+     /* Keys read but not yet handled */
+     unsigned char in[16];
+     size_t inlen;
+} ansi_t;
+
+/* One output terminal. The screen, windows, geometry and frame are swapped
+ * in and out of the ttyclock struct by term_select(), the same way
+ * set_term() swaps stdscr, LINES and COLS. */
+typedef struct
+{
+     char *path;
+     int fd;
+     /* Read end of the pipe ncurses writes into, -1 to write directly */
+     int outfd;
+     FILE *in, *out;
+     struct termios mode;
+     /* mode holds the settings to restore */
+     Bool moded;
+     Bool dead;
+     /* Iconified, as the terminal reported it (see key_event()) */
+     Bool hidden;
+     int lines, cols;
+
+     /* Output not yet accepted by the tty */
+     char buf[TERMBUF];
+     size_t off, len;
+
+     /* Options as last applied to this terminal (see term_sync()) */
+     struct
+     {
+          Bool box, center, second;
+          int color, font;
+     } applied;
+
+     SCREEN *scr;
+     WINDOW *framewin, *datewin, *barwin;
+     geo_t geo;
+     frame_t frame;
+     ansi_t ansi;
+
+     struct
+     {
+          unsigned long bytes;
+          unsigned long frames;
+          unsigned long dropped;
+     } stats;
+} term_t;
+
 /* Global ttyclock struct */
 typedef struct
 {
@@ -67,8 +381,17 @@ typedef struct
     
      /* terminal variables */ 
      SCREEN *ttyscr;
-     char *tty;
      int bg;
+     term_t term[MAXTERMS];
+     int nterm;
+     term_t *cur;
+
+     /* Event sources (see init_events()) */
+     int timerfd;
+     int sigfd;
+     int resizefd;
+     int animfd;
+     int barfd;
 
      /* Running option */
      struct
@@ -88,25 +411,97 @@ typedef struct
           long delay;
           Bool blink;
           long nsdelay;
+          Bool suspend;
+          char *socket;
+          char *journal;
+          char *tag;
+          /* Draw with ansi.c instead of ncurses */
+          Bool ansi;
+          /* Digit scale, 0 for the largest that fits */
+          int scale;
+          /* Start the next --cycle phase without waiting for 'p' */
+          Bool autoadvance;
+          /* Ring the terminal bell when a phase ends */
+          Bool bell;
+          /* Rebound animation frames per second */
+          int fps;
+          /* --stream line format, or "json"; NULL to draw */
+          char *stream;
+          /* 1 for the --font atlas, 0 for the built-in one */
+          int font;
+          /* Bar of the phase gone by under the frame, in eighths of a
+           * cell if the locale has them */
+          Bool progress, eighths;
+          /* Hours and minutes left instead of minutes and seconds */
+          Bool minutes;
+          /* --config path, NULL for the default */
+          char *config;
+          /* Phase lengths set in the config file, 0 for the built-in ones */
+          int64_t length[3];
+          /* Report range and output format */
+          char *from, *to;
+          char *report_format;
      } option;
 
      /* Clock geometry */
-     struct
-     {
-          int x, y, w, h;
-          /* For rebound use (see clock_rebound())*/
-          int a, b;
-     } geo;
+     geo_t geo;
+
+     /* Running countdown and its value as of the last update_hour() */
+     phase_t phase;
+     /* Position in the --cycle sequence */
+     unsigned int cycle;
+     countdown_t countdown;
+     remaining_t remaining;
 
      /* Date content ([2] = number by number) */
      struct
      {
-          unsigned int hour[2];
-          unsigned int minute[2];
           unsigned int second[2];
           char datestr[256];
      } date;
 
+     /* What the last draw_clock() left on screen */
+     frame_t frame;
+
+     /* Render and timing counters, served by metrics.c */
+     struct
+     {
+          unsigned long frames;
+          unsigned long cells;
+          unsigned int last_cells;
+          /* Start of main() to the first frame, ns, when resumed */
+          int64_t first_frame;
+          unsigned long wakeups;
+          unsigned long keys;
+          /* Time spent in update_hour() and draw_clock() */
+          int64_t update_ns, draw_ns;
+          /* Tick lateness: per bucket, total and count */
+          unsigned long late[METRICS_BUCKETS + 1];
+          int64_t late_ns;
+          unsigned long ticks;
+          /* SIGWINCHs received and resizes applied */
+          unsigned long winches, resizes;
+          /* Rebound animation frames, their CPU time and bytes written */
+          unsigned long rebound_frames, rebound_bytes;
+          int64_t rebound_ns;
+          /* --stream lines written, and replaced before stdout took them */
+          unsigned long stream_lines, stream_dropped;
+          /* --progress updates between ticks, and bytes written for them */
+          unsigned long progress_frames, progress_bytes;
+          /* Attached viewers, changes sent to them, bytes, and viewers
+           * sent a snapshot for the changes they were too slow to take */
+          unsigned long share_viewers, share_events, share_bytes, share_resyncs;
+          /* Start of the run, for the wakeups per hour */
+          int64_t started;
+          /* Config file reloads, and reloads refused for a bad line */
+          unsigned long config_reloads, config_errors;
+          /* --split layouts computed, and tiles repainted */
+          unsigned long split_layouts, split_tiles;
+     } stats;
+
+     /* When the next tick is due on the countdown clock, and the interval */
+     int64_t tick_due, tick_interval;
+
      /* time.h utils */
      struct tm *tm;
      time_t lt;
@@ -115,38 +510,194 @@ typedef struct
      char *meridiem;
      WINDOW *framewin;
      WINDOW *datewin;
+     WINDOW *barwin;
 
 } ttyclock_t;
 
 /* Prototypes */
+void init_terms(void);
 void init(void);
 void signal_handler(int signal);
 void update_hour(void);
+void draw_glyph(int c, int x, int y, int pair, Bool erase);
 void draw_number(int n, int x, int y);
+void draw_colon(int y, int pair);
+void invalidate_frame(void);
 void time_ended();
+void clock_digits(const remaining_t *r, int *digit);
 void draw_clock(void);
 void clock_move(int x, int y, int w, int h);
+void clock_shift(int dx, int dy);
+void clock_rebound(void);
+void arm_rebound(void);
+void rebound_frame(void);
 void set_second(void);
+void apply_second(void);
+void apply_resize(void);
 void set_center(Bool b);
 void set_box(Bool b);
 void key_event(void);
+void toggle_pause(void);
+void init_events(void);
+Bool on_screen(void);
+int64_t tick_unit(void);
+int64_t tick_next(void);
+void arm_timer(void);
+void draw_terms(void);
+void term_sync(void);
+
+/* Output terminals (term.c) */
+int  term_open(term_t *t);
+void term_select(term_t *t);
+Bool term_resize(term_t *t);
+size_t term_backlog(term_t *t);
+void term_lost(term_t *t);
+void term_flush(term_t *t);
+void term_report(term_t *t, const char *seq);
+void term_close(term_t *t);
+
+/* Raw ANSI backend (ansi.c) */
+void ansi_open(term_t *t);
+void ansi_init(void);
+void ansi_span(int x, int y, int w, int pair);
+void ansi_box(Bool b);
+void ansi_bar(int c, int eighths);
+void ansi_move(int x, int y);
+void ansi_shift(int dx, int dy);
+void ansi_invalidate(void);
+void ansi_flush(void);
+int  ansi_getch(void);
+void ansi_bell(void);
+void ansi_close(term_t *t);
+
+/* Countdown engine (countdown.c) */
+int64_t clock_ns(clockid_t clock);
+void clock_set_virtual(int64_t t);
+void countdown_start(countdown_t *cd, clockid_t clock, int64_t length);
+void countdown_pause(countdown_t *cd);
+void countdown_resume(countdown_t *cd);
+int64_t countdown_left(const countdown_t *cd);
+void countdown_remaining(const countdown_t *cd, remaining_t *r);
+int64_t countdown_next_tick(const countdown_t *cd, int64_t unit);
+
+/* Timer daemon and its thin client (daemon.c) */
+const char *socket_path(void);
+int  socket_connect(const char *path);
+int  socket_listen(const char *path);
+int  daemon_run(void);
+int  client_attach(const char *id, int64_t length);
+Bool client_attached(void);
+void client_pause(Bool pause);
+
+/* Attach server and viewers (share.c) */
+const char *share_path(void);
+int  share_attach(void);
+Bool share_serving(void);
+Bool share_viewing(void);
+void share_publish(void);
+void share_end(void);
+void share_close(void);
+void share_pause(void);
+
+/* Session journal (journal.c) */
+uint32_t crc32(const void *buf, size_t len);
+const char *data_path(const char *name);
+const char *journal_path(void);
+int  journal_open(void);
+void journal_append(int type);
+void journal_sync(void);
+void journal_close(void);
+int  journal_map(const char *path, journal_map_t *m);
+void journal_unmap(journal_map_t *m);
+Bool journal_valid(const journal_rec_t *r);
+size_t journal_seek(const journal_map_t *m, int64_t time);
+
+/* Checkpoint of the running timer (checkpoint.c) */
+int  checkpoint_open(void);
+void checkpoint_save(void);
+void checkpoint_clear(void);
+int  checkpoint_restore(void);
+
+/* Cycle scheduler (schedule.c) */
+int  schedule_parse(const char *spec);
+Bool schedule_active(void);
+int64_t schedule_begin(void);
+void schedule_plan(void);
+const schedule_t *schedule_get(int *n);
+void schedule_advance(void);
+void schedule_print(void);
+const char *schedule_phase_name(phase_t phase);
+int64_t phase_length(phase_t phase);
+
+/* Notifications (notify.c) */
+int  notify_add(const char *cmd, int64_t timeout);
+int  notify_start(void);
+void notify_phase_end(phase_t phase, phase_t next, Bool last);
+void notify_stop(int64_t wait);
+void notify_get_stats(notify_stats_t *s);
+
+/* Published state (status.c) */
+int  status_open(void);
+void status_publish(void);
+void status_close(void);
+const status_t *status_map(void);
+int  status_read(const status_t *map, status_t *s);
+int  status_query(void);
+
+/* Line output (stream.c) */
+void stream_open(void);
+void stream_frame(void);
+
+/* Progress bar (progress.c) */
+void progress_open(void);
+void draw_progress(void);
+void arm_progress(void);
+void progress_frame(void);
+
+/* Split screen (split.c) */
+int  split_parse(const char *spec);
+Bool split_active(void);
+void split_open(void);
+void split_layout(void);
+void split_frame(void);
+void arm_split(void);
+Bool split_ignores(int c);
+void split_close(void);
+
+/* Simulation on the virtual clock (sim.c) */
+int  sim_load(const char *path);
+Bool sim_tick(int64_t until);
+void sim_run(void);
+
+/* Fonts (font.c) */
+int  font_load(const char *path);
+Bool font_loaded(void);
+int  font_dump(void);
+int  font_spans(int c, int scale, int pair, span_t *sp);
+
+/* Configuration file (config.c) */
+const char *config_path(void);
+void config_load(void);
+void config_watch(void);
+void config_close(void);
+
+/* Metrics endpoint (metrics.c) */
+int  metrics_listen(const char *spec);
+void metrics_late(int64_t ns);
+
+/* Reports (report.c) */
+int  report_run(const char *kind);
+
+/* Event loop (loop.c) */
+typedef void (*loop_cb_t)(int fd, short revents, void *arg);
+
+int  loop_add(int fd, short events, loop_cb_t cb, void *arg);
+void loop_del(int fd);
+void loop_set_events(int fd, short events);
+void loop_soft(int64_t when, loop_cb_t cb);
+int  loop_once(int timeout);
 
 /* Global variable */
-ttyclock_t *ttyclock;
-
-/* Number matrix */
-const Bool number[][15] =
-{
-     {1,1,1,1,0,1,1,0,1,1,0,1,1,1,1}, /* 0 */
-     {0,0,1,0,0,1,0,0,1,0,0,1,0,0,1}, /* 1 */
-     {1,1,1,0,0,1,1,1,1,1,0,0,1,1,1}, /* 2 */
-     {1,1,1,0,0,1,1,1,1,0,0,1,1,1,1}, /* 3 */
-     {1,0,1,1,0,1,1,1,1,0,0,1,0,0,1}, /* 4 */
-     {1,1,1,1,0,0,1,1,1,0,0,1,1,1,1}, /* 5 */
-     {1,1,1,1,0,0,1,1,1,1,0,1,1,1,1}, /* 6 */
-     {1,1,1,0,0,1,0,0,1,0,0,1,0,0,1}, /* 7 */
-     {1,1,1,1,0,1,1,1,1,1,0,1,1,1,1}, /* 8 */
-     {1,1,1,1,0,1,1,1,1,0,0,1,1,1,1}, /* 9 */
-};
+extern ttyclock_t *ttyclock;
 
 #endif /* TTYCLOCK_H_INCLUDED */